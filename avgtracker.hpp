@@ -2,6 +2,7 @@
 #define AVGTRACKER_HPP
 
 #include <array>
+#include <cstddef>
 
 template<typename T, size_t N>
 class AvgTracker {
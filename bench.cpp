@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include "simulation.hpp"
+#include "frame_dumper.hpp"
+
+//drives the simulation through scripted scenarios and writes the numbers as JSON:
+//  falling_stuff_bench [ticks] [max threads] [seed] [output.json]
+//every scenario runs for the same number of ticks with every thread count up to the max;
+//the world is the initial 1024x512 one and it's all on screen, so nothing gets streamed
+//or updated at a reduced rate; with 0 threads the runs are fully reproducible
+
+using Clock = std::chrono::steady_clock;
+
+const int WIDTH = 1024;
+const int HEIGHT = 512;
+
+struct Scenario {
+    const char *name;
+    //ticks to run before measuring, so that the world gets a chance to settle
+    int warmup;
+    void (*setup)(Simulation&);
+};
+
+static void wall(Simulation &sim, int x, int y, int xx, int yy) {
+    int n = std::max(std::abs(xx - x), std::abs(yy - y)) / 2 + 1;
+    for (int i = 0; i <= n; ++i)
+        sim.spawn_cloud(x + (xx - x) * i / n, y + (yy - y) * i / n, 3, ParticleType::Wood);
+}
+
+static void sand_avalanche(Simulation &sim) {
+    for (int x = 100; x < WIDTH; x += 200)
+        sim.spawn_cloud(x, 120, 90, ParticleType::Sand);
+}
+
+static void water_basin(Simulation &sim) {
+    wall(sim, 100, 200, 100, HEIGHT - 10);
+    wall(sim, 100, HEIGHT - 10, WIDTH - 100, HEIGHT - 10);
+    wall(sim, WIDTH - 100, HEIGHT - 10, WIDTH - 100, 200);
+    for (int x = 200; x < WIDTH - 100; x += 150)
+        sim.spawn_cloud(x, 150, 70, ParticleType::Water);
+}
+
+static void forest_fire(Simulation &sim) {
+    //the crowns overlap, so the fire can go all the way across
+    wall(sim, 0, HEIGHT - 3, WIDTH - 1, HEIGHT - 3);
+    for (int x = 40; x < WIDTH; x += 60) {
+        wall(sim, x, HEIGHT - 1, x, HEIGHT - 200 - x % 90);
+        sim.spawn_cloud(x, HEIGHT - 220 - x % 90, 35, ParticleType::Wood);
+    }
+    sim.spawn_cloud(40, HEIGHT - 5, 4, ParticleType::Fire);
+    sim.spawn_cloud(WIDTH - 20, HEIGHT - 5, 4, ParticleType::Fire);
+}
+
+static void mixed_chaos(Simulation &sim) {
+    water_basin(sim);
+    sim.spawn_cloud(300, 60, 50, ParticleType::Sand);
+    sim.spawn_cloud(700, 60, 50, ParticleType::Sand);
+    sim.spawn_cloud(WIDTH / 2, 300, 40, ParticleType::Wood);
+    sim.spawn_cloud(WIDTH / 2, 300, 4, ParticleType::Fire);
+    sim.spawn_cloud(50, 100, 40, ParticleType::Sand);
+    sim.spawn_cloud(WIDTH - 50, 100, 40, ParticleType::Water);
+}
+
+static void idle_world(Simulation &sim) {
+    for (int x = 100; x < WIDTH; x += 200)
+        sim.spawn_cloud(x, HEIGHT - 100, 60, ParticleType::Sand);
+}
+
+const Scenario SCENARIOS[] = {
+    { "sand_avalanche", 0, sand_avalanche },
+    { "water_basin", 0, water_basin },
+    { "forest_fire", 0, forest_fire },
+    { "mixed_chaos", 0, mixed_chaos },
+    { "idle", 3000, idle_world },
+};
+
+struct Result {
+    size_t num_threads;
+    double total_ms;
+    //per tick
+    double io_ms, propagate_ms, schedule_ms, prepare_ms, update_ms, render_ms;
+    long long updated, tested;
+    //of the whole update()
+    Percentiles tick_pct;
+};
+
+static Result run(const Scenario &scenario, int ticks, size_t num_threads, uint32_t seed) {
+    FrameDumper dumper("", 0);
+    SimulationConfig config;
+    config.num_threads = num_threads;
+    config.seed = seed;
+    Simulation sim(dumper, config);
+    scenario.setup(sim);
+    for (int i = 0; i < scenario.warmup; ++i)
+        sim.update();
+    sim.reset_histograms();
+
+    Result r{};
+    r.num_threads = num_threads;
+    auto start = Clock::now();
+    for (int i = 0; i < ticks; ++i) {
+        sim.update();
+        auto t = Clock::now();
+        sim.render();
+        r.render_ms += std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+
+        const auto &phases = sim.phase_times();
+        r.io_ms += phases.io;
+        r.propagate_ms += phases.propagate;
+        r.schedule_ms += phases.schedule;
+        r.prepare_ms += phases.prepare;
+        r.update_ms += phases.update;
+        r.updated += sim.num_updated_particles();
+        r.tested += sim.num_tested_particles();
+    }
+    r.total_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    r.tick_pct = sim.phase_histograms().total.percentiles(1e-3f);
+
+    double n = std::max(ticks, 1);
+    for (double *ms: { &r.io_ms, &r.propagate_ms, &r.schedule_ms, &r.prepare_ms, &r.update_ms, &r.render_ms })
+        *ms /= n;
+    return r;
+}
+
+static void write_result(FILE *out, const Result &r, const Result &base, bool last) {
+    double secs = r.total_ms / 1e3;
+    fprintf(out, "        { \"threads\": %zu, \"total_ms\": %.3f, \"speedup\": %.3f,\n",
+            r.num_threads, r.total_ms, r.total_ms > 0 ? base.total_ms / r.total_ms : 0.0);
+    fprintf(out, "          \"phases_ms_per_tick\": { \"io\": %.4f, \"propagate\": %.4f, \"schedule\": %.4f, "
+            "\"prepare\": %.4f, \"update\": %.4f, \"render\": %.4f },\n",
+            r.io_ms, r.propagate_ms, r.schedule_ms, r.prepare_ms, r.update_ms, r.render_ms);
+    const Percentiles &p = r.tick_pct;
+    fprintf(out, "          \"update_ms\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+            "\"p99.9\": %.3f, \"max\": %.3f },\n", p.p50, p.p90, p.p99, p.p999, p.max);
+    fprintf(out, "          \"updated\": %lld, \"tested\": %lld, \"updated_per_tested\": %.4f, "
+            "\"updated_per_sec\": %.1f }%s\n",
+            r.updated, r.tested, r.tested ? double(r.updated) / r.tested : 0.0,
+            secs > 0 ? r.updated / secs : 0.0, last ? "" : ",");
+}
+
+int main(int argc, char **argv) {
+    int ticks = argc > 1 ? atoi(argv[1]) : 600;
+    size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    size_t max_threads = argc > 2 ? strtoul(argv[2], nullptr, 10) : hw - 1;
+    max_threads = std::min(max_threads, MAX_THREADS - 1);
+    uint32_t seed = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 1;
+    FILE *out = stdout;
+    if (argc > 4 && !(out = fopen(argv[4], "w"))) {
+        printf("FAILED TO OPEN %s\n", argv[4]);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"ticks\": %d, \"seed\": %u, \"hardware_threads\": %zu,\n  \"scenarios\": [\n",
+            ticks, seed, hw);
+    size_t num_scenarios = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+    for (size_t s = 0; s < num_scenarios; ++s) {
+        const Scenario &scenario = SCENARIOS[s];
+        fprintf(out, "    { \"name\": \"%s\", \"warmup\": %d, \"runs\": [\n", scenario.name, scenario.warmup);
+        Result base{};
+        //the calling thread always works as well, 0 means it's the only one
+        for (size_t t = 0; t <= max_threads; ++t) {
+            Result r = run(scenario, ticks, t, seed);
+            if (t == 0)
+                base = r;
+            write_result(out, r, base, t == max_threads);
+            fflush(out);
+        }
+        fprintf(out, "    ] }%s\n", s + 1 == num_scenarios ? "" : ",");
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+}
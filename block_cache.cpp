@@ -0,0 +1,113 @@
+#include "block_cache.hpp"
+#include <cstring>
+#include <cassert>
+#include "world.hpp"
+
+static_assert(sizeof(Particle) == sizeof(uint32_t), "particles are compared as words");
+
+BlockCache::BlockCache(size_t budget)
+    : m_budget(budget), m_size(0) {}
+
+void BlockCache::put(size_t blk_x, size_t blk_y, const Block &blk) {
+    Key key(blk_x, blk_y);
+    auto it = m_entries.find(key);
+    if (it != m_entries.end())
+        erase(it->second);
+
+    m_lru.push_front({ key, {} });
+    compress(blk, m_lru.front().data);
+    m_lru.front().data.shrink_to_fit();
+    m_size += entry_size(m_lru.front());
+    m_entries[key] = m_lru.begin();
+}
+
+bool BlockCache::take(size_t blk_x, size_t blk_y, Block &blk) {
+    auto it = m_entries.find(Key(blk_x, blk_y));
+    if (it == m_entries.end())
+        return false;
+    decompress(it->second->data, blk);
+    erase(it->second);
+    return true;
+}
+
+bool BlockCache::pop_lru(size_t &blk_x, size_t &blk_y, Block &blk) {
+    if (m_lru.empty())
+        return false;
+    auto it = std::prev(m_lru.end());
+    blk_x = it->key.first;
+    blk_y = it->key.second;
+    decompress(it->data, blk);
+    erase(it);
+    return true;
+}
+
+void BlockCache::erase(std::list<Entry>::iterator it) {
+    m_size -= entry_size(*it);
+    m_entries.erase(it->key);
+    m_lru.erase(it);
+}
+
+size_t BlockCache::entry_size(const Entry &e) {
+    //roughly what the list and the map nodes take
+    const size_t OVERHEAD = 128;
+    return e.data.capacity() + OVERHEAD;
+}
+
+template<typename T>
+static void append(std::vector<uint8_t> &out, const T &x) {
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(&x);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template<typename T>
+static void extract(const uint8_t *&in, T &x) {
+    memcpy(static_cast<void*>(&x), in, sizeof(T));
+    in += sizeof(T);
+}
+
+void BlockCache::compress(const Block &blk, std::vector<uint8_t> &out) {
+    out.clear();
+    for (auto &row: blk.chunks) {
+        for (auto &ch: row) {
+            append(out, ch.cur_dirty_rect);
+            append(out, ch.next_dirty_rect);
+            append(out, ch.is_uniform);
+            append(out, ch.uniform);
+
+            const uint32_t *cells = reinterpret_cast<const uint32_t*>(&ch.data[0][0]);
+            const size_t n = Chunk::SIZE * Chunk::SIZE;
+            for (size_t i = 0; i < n;) {
+                size_t len = 1;
+                while (i + len < n && len < UINT16_MAX && cells[i + len] == cells[i])
+                    ++len;
+                append(out, static_cast<uint16_t>(len));
+                append(out, cells[i]);
+                i += len;
+            }
+        }
+    }
+}
+
+void BlockCache::decompress(const std::vector<uint8_t> &in, Block &blk) {
+    const uint8_t *p = in.data();
+    for (auto &row: blk.chunks) {
+        for (auto &ch: row) {
+            extract(p, ch.cur_dirty_rect);
+            extract(p, ch.next_dirty_rect);
+            extract(p, ch.is_uniform);
+            extract(p, ch.uniform);
+
+            uint32_t *cells = reinterpret_cast<uint32_t*>(&ch.data[0][0]);
+            const size_t n = Chunk::SIZE * Chunk::SIZE;
+            for (size_t i = 0; i < n;) {
+                uint16_t len;
+                uint32_t cell;
+                extract(p, len);
+                extract(p, cell);
+                std::fill(cells + i, cells + i + len, cell);
+                i += len;
+            }
+        }
+    }
+    assert(p == in.data() + in.size());
+}
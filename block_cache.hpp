@@ -0,0 +1,53 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+
+#include <vector>
+#include <list>
+#include <map>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+struct Block;
+
+//Recently evicted blocks, kept compressed in memory.
+//Every chunk is run-length encoded as (uint16 length, particle) pairs,
+//so an empty or a uniform chunk takes a few bytes instead of 16k.
+//Once over budget, the least recently stored blocks have to go to the disk.
+class BlockCache {
+public:
+    explicit BlockCache(size_t budget);
+
+    //replaces the previous version of the block, if any
+    void put(size_t blk_x, size_t blk_y, const Block &blk);
+    //decompresses and removes the block, since from now on the resident copy is the latest one
+    bool take(size_t blk_x, size_t blk_y, Block &blk);
+
+    bool over_budget() const { return m_size > m_budget; }
+    //decompresses and removes the least recently stored block
+    bool pop_lru(size_t &blk_x, size_t &blk_y, Block &blk);
+
+    size_t size() const { return m_size; }
+    size_t budget() const { return m_budget; }
+    size_t num_blocks() const { return m_entries.size(); }
+
+private:
+    using Key = std::pair<size_t, size_t>;
+    struct Entry {
+        Key key;
+        std::vector<uint8_t> data;
+    };
+
+    size_t m_budget, m_size;
+    //most recent at the front
+    std::list<Entry> m_lru;
+    std::map<Key, std::list<Entry>::iterator> m_entries;
+
+    void erase(std::list<Entry>::iterator it);
+    static size_t entry_size(const Entry &e);
+
+    static void compress(const Block &blk, std::vector<uint8_t> &out);
+    static void decompress(const std::vector<uint8_t> &in, Block &blk);
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include "block_io.hpp"
+#include <algorithm>
+#include <cstring>
+#include "region_store.hpp"
+#include "world.hpp"
+#include "terrain.hpp"
+
+BlockIO::BlockIO(std::unique_ptr<RegionStore> store, size_t cache_budget,
+        const TerrainGenerator *generator)
+    : m_store(std::move(store)), m_generator(generator), m_cache(cache_budget), m_cache_size(0), m_cache_blocks(0),
+      m_stop(false), m_busy(false)
+{
+    m_thread = std::thread(&BlockIO::thread_routine, this);
+}
+
+void BlockIO::store(size_t blk_x, size_t blk_y, const Block &blk) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    Block *staging = acquire();
+    lock.unlock();
+    //the staging buffer isn't visible to the I/O thread yet
+    memcpy(static_cast<void*>(staging), &blk, sizeof(Block));
+
+    lock.lock();
+    m_queue.push_back({ Store, blk_x, blk_y, staging, false });
+    lock.unlock();
+    m_cv.notify_one();
+}
+
+void BlockIO::request(size_t blk_x, size_t blk_y) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (std::find(m_requested.begin(), m_requested.end(), 
+                std::make_pair(blk_x, blk_y)) != m_requested.end())
+        return;
+    m_requested.emplace_back(blk_x, blk_y);
+    m_queue.push_back({ Load, blk_x, blk_y, nullptr, false });
+    lock.unlock();
+    m_cv.notify_one();
+}
+
+bool BlockIO::is_requested(size_t blk_x, size_t blk_y) const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return std::find(m_requested.begin(), m_requested.end(), 
+            std::make_pair(blk_x, blk_y)) != m_requested.end();
+}
+
+void BlockIO::poll(std::vector<Loaded> &loaded) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto &i: m_done) {
+        m_requested.erase(std::find(m_requested.begin(), m_requested.end(), 
+                    std::make_pair(i.blk_x, i.blk_y)));
+        loaded.push_back(i);
+    }
+    m_done.clear();
+}
+
+void BlockIO::release(Block *blk) {
+    if (!blk)
+        return;
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_free.push_back(blk);
+}
+
+void BlockIO::discard(const Loaded &loaded) {
+    if (!loaded.blk)
+        return;
+    if (!loaded.cached) {
+        release(loaded.blk);
+        return;
+    }
+    //the buffer goes back to the pool once it's stored
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_queue.push_back({ Store, loaded.blk_x, loaded.blk_y, loaded.blk, false });
+    lock.unlock();
+    m_cv.notify_one();
+}
+
+bool BlockIO::load_now(size_t blk_x, size_t blk_y, Block &blk) {
+    //the pending stores might contain this very block
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_idle.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+    bool cached;
+    bool ok = read(blk_x, blk_y, blk, cached);
+    m_cache_size = m_cache.size();
+    m_cache_blocks = m_cache.num_blocks();
+    return ok;
+}
+
+void BlockIO::flush() {
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_idle.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+        //nothing gets queued meanwhile, the caller is the only producer
+        m_busy = true;
+    }
+    spill(true);
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_busy = false;
+    m_cache_size = m_cache.size();
+    m_cache_blocks = m_cache.num_blocks();
+}
+
+size_t BlockIO::cache_size() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_cache_size;
+}
+
+size_t BlockIO::cache_blocks() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_cache_blocks;
+}
+
+size_t BlockIO::staging_size() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_pool.size() * sizeof(Block) + m_queue.size() * sizeof(Request) 
+        + m_done.capacity() * sizeof(Loaded) + m_requested.capacity() * sizeof(std::pair<size_t, size_t>);
+}
+
+BlockIO::~BlockIO() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+}
+
+Block* BlockIO::acquire() {
+    if (m_free.empty()) {
+        m_pool.emplace_back(new Block);
+        return m_pool.back().get();
+    }
+    Block *blk = m_free.back();
+    m_free.pop_back();
+    return blk;
+}
+
+void BlockIO::thread_routine() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    while (true) {
+        m_cv.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+        //the queued stores must reach the disk before quitting
+        if (m_queue.empty())
+            break;
+
+        Request req = m_queue.front();
+        m_queue.pop_front();
+        m_busy = true;
+        if (req.op == Load)
+            req.blk = acquire();
+        lock.unlock();
+
+        bool ok = true;
+        if (req.op == Store) {
+            m_cache.put(req.blk_x, req.blk_y, *req.blk);
+            spill(false);
+        } else {
+            ok = read(req.blk_x, req.blk_y, *req.blk, req.cached);
+        }
+
+        lock.lock();
+        m_busy = false;
+        m_cache_size = m_cache.size();
+        m_cache_blocks = m_cache.num_blocks();
+        if (req.op == Store) {
+            m_free.push_back(req.blk);
+        } else {
+            if (!ok) {
+                m_free.push_back(req.blk);
+                req.blk = nullptr;
+            }
+            m_done.push_back({ req.blk_x, req.blk_y, req.blk, req.cached });
+        }
+        if (m_queue.empty())
+            m_idle.notify_all();
+    }
+
+    //nobody is going to poll the loads any more, the ones that came from the cache go back
+    for (auto &i: m_done)
+        if (i.blk && i.cached)
+            m_cache.put(i.blk_x, i.blk_y, *i.blk);
+    m_done.clear();
+    lock.unlock();
+    spill(true);
+}
+
+void BlockIO::spill(bool everything) {
+    if (!m_cache.num_blocks() || (!everything && !m_cache.over_budget()))
+        return;
+
+    Block *staging;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        staging = acquire();
+    }
+
+    size_t blk_x, blk_y;
+    while ((everything || m_cache.over_budget()) && m_cache.pop_lru(blk_x, blk_y, *staging)) {
+        if (!m_store->write_block(blk_x, blk_y, *staging))
+            printf("FAILED TO STORE BLOCK %zu, %zu\n", blk_x, blk_y);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_free.push_back(staging);
+}
+
+bool BlockIO::read(size_t blk_x, size_t blk_y, Block &blk, bool &cached) {
+    cached = m_cache.take(blk_x, blk_y, blk);
+    if (cached || m_store->read_block(blk_x, blk_y, blk))
+        return true;
+    if (!m_generator)
+        return false;
+    m_generator->generate(blk_x, blk_y, blk);
+    return true;
+}
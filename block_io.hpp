@@ -0,0 +1,105 @@
+#ifndef BLOCK_IO_HPP
+#define BLOCK_IO_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "block_cache.hpp"
+
+struct Block;
+class RegionStore;
+class TerrainGenerator;
+
+//Moves block I/O off the simulation thread.
+//Evicted blocks get copied into staging buffers and compressed into the cache in the background,
+//the cache spills the oldest ones to the disk once over budget.
+//Requested blocks get read (or decompressed) into staging buffers and handed back through poll().
+//The requests are served in order, so a load always sees the stores queued before it.
+//With a generator, the blocks that have never been stored get generated on the I/O thread.
+class BlockIO {
+public:
+    struct Loaded {
+        size_t blk_x, blk_y;
+        //nullptr if the block has never been stored (and there's no generator)
+        Block *blk;
+        //taken out of the cache, so this is the only up-to-date copy
+        bool cached;
+    };
+
+    //the generator must outlive the BlockIO
+    BlockIO(std::unique_ptr<RegionStore> store, size_t cache_budget, 
+            const TerrainGenerator *generator = nullptr);
+
+    //copies the block, so the slot can be reused right away
+    void store(size_t blk_x, size_t blk_y, const Block &blk);
+
+    //does nothing if the block is already being loaded
+    void request(size_t blk_x, size_t blk_y);
+    bool is_requested(size_t blk_x, size_t blk_y) const;
+
+    //takes the finished loads, their buffers must be given back with release(),
+    //or with discard() if the block doesn't get used
+    void poll(std::vector<Loaded> &loaded);
+    void release(Block *blk);
+    //gives back the buffer of an unused load; a block that came from the cache gets stored again
+    void discard(const Loaded &loaded);
+
+    //blocks the caller until the block is read; for startup and explicit loads
+    bool load_now(size_t blk_x, size_t blk_y, Block &blk);
+
+    //waits for the queued requests and writes the whole cache to the disk
+    void flush();
+
+    //approximate, in bytes
+    size_t cache_size() const;
+    size_t cache_blocks() const;
+    //the staging buffers and the queue, in bytes
+    size_t staging_size() const;
+
+    //waits for the queued requests to finish and writes out the cache
+    ~BlockIO();
+
+private:
+    enum Op {
+        Store,
+        Load,
+    };
+
+    struct Request {
+        Op op;
+        size_t blk_x, blk_y;
+        Block *blk;
+        bool cached;
+    };
+
+    std::unique_ptr<RegionStore> m_store;
+    const TerrainGenerator *m_generator;
+    //only touched by the I/O thread, or while it's idle
+    BlockCache m_cache;
+    size_t m_cache_size, m_cache_blocks;
+
+    std::deque<Request> m_queue;
+    std::vector<Loaded> m_done;
+    //loads that are queued or done but not polled yet
+    std::vector<std::pair<size_t, size_t>> m_requested;
+    //staging buffers, allocated on demand and recycled
+    std::vector<std::unique_ptr<Block>> m_pool;
+    std::vector<Block*> m_free;
+    bool m_stop;
+
+    std::thread m_thread;
+    mutable std::mutex m_mtx;
+    std::condition_variable m_cv, m_idle;
+    bool m_busy;
+
+    Block* acquire();
+    void thread_routine();
+    //spills the oldest cached blocks to the disk, all of them if everything is true
+    void spill(bool everything);
+    bool read(size_t blk_x, size_t blk_y, Block &blk, bool &cached);
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "chunk_costs.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+const char* chunk_metric_name(ChunkMetric metric) {
+    switch (metric) {
+    case UpdateTime:
+        return "update_us";
+    case Tested:
+        return "tested";
+    case Updated:
+        return "updated";
+    case Redrawn:
+        return "redrawn";
+    case Straggler:
+        return "straggler";
+    default:
+        return "?";
+    }
+}
+
+ChunkCosts::ChunkCosts(size_t span)
+    : m_span(span), m_entries(span * span)
+{
+    clear();
+}
+
+void ChunkCosts::record(size_t ch_x, size_t ch_y, uint64_t tick, ChunkMetric metric, float value) {
+    Entry &e = entry(ch_x, ch_y);
+    if (e.ch_x != ch_x || e.ch_y != ch_y) {
+        e.ch_x = ch_x;
+        e.ch_y = ch_y;
+        std::fill(std::begin(e.epochs), std::end(e.epochs), NEVER);
+    }
+    uint64_t epoch = tick / BUCKET_TICKS;
+    size_t b = epoch % BUCKETS;
+    if (e.epochs[b] != epoch) {
+        e.epochs[b] = epoch;
+        std::fill(std::begin(e.sums[b]), std::end(e.sums[b]), 0.f);
+    }
+    e.sums[b][metric] += value;
+}
+
+ChunkCost ChunkCosts::get(size_t ch_x, size_t ch_y, uint64_t tick) const {
+    const Entry &e = entry(ch_x, ch_y);
+    if (e.ch_x != ch_x || e.ch_y != ch_y)
+        return ChunkCost();
+    return sum(e, tick);
+}
+
+void ChunkCosts::clear() {
+    for (auto &e: m_entries) {
+        //no chunk lives at the far end of the world
+        e.ch_x = e.ch_y = SIZE_MAX;
+        std::fill(std::begin(e.epochs), std::end(e.epochs), NEVER);
+    }
+}
+
+ChunkCost ChunkCosts::sum(const Entry &e, uint64_t tick) {
+    ChunkCost res;
+    uint64_t epoch = tick / BUCKET_TICKS;
+    for (size_t b = 0; b < BUCKETS; ++b) {
+        if (e.epochs[b] == NEVER || e.epochs[b] > epoch || e.epochs[b] + BUCKETS <= epoch)
+            continue;
+        for (int m = 0; m < NUM_CHUNK_METRICS; ++m)
+            res.values[m] += e.sums[b][m];
+    }
+    return res;
+}
+
+ChunkCosts::Entry& ChunkCosts::entry(size_t ch_x, size_t ch_y) {
+    return m_entries[(ch_y % m_span) * m_span + ch_x % m_span];
+}
+
+const ChunkCosts::Entry& ChunkCosts::entry(size_t ch_x, size_t ch_y) const {
+    return m_entries[(ch_y % m_span) * m_span + ch_x % m_span];
+}
+
+static bool any_cost(const ChunkCost &c) {
+    return std::any_of(std::begin(c.values), std::end(c.values), [](float v) { return v != 0.f; });
+}
+
+Rect<int> ChunkCosts::bounds(uint64_t tick) const {
+    Rect<int> res;
+    res.reset();
+    for (auto &e: m_entries)
+        if (e.ch_x != SIZE_MAX && any_cost(sum(e, tick)))
+            res.include<false>(static_cast<int>(e.ch_x), static_cast<int>(e.ch_y));
+    return res;
+}
+
+bool ChunkCosts::write_csv(const std::string &path, uint64_t tick) const {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        printf("FAILED TO OPEN %s\n", path.c_str());
+        return false;
+    }
+    fprintf(out, "ch_x,ch_y");
+    for (int m = 0; m < NUM_CHUNK_METRICS; ++m)
+        fprintf(out, ",%s", chunk_metric_name(static_cast<ChunkMetric>(m)));
+    fprintf(out, "\n");
+
+    //row by row, whatever the ring order is
+    std::vector<const Entry*> rows;
+    for (auto &e: m_entries)
+        if (e.ch_x != SIZE_MAX && any_cost(sum(e, tick)))
+            rows.push_back(&e);
+    std::sort(rows.begin(), rows.end(), [](const Entry *lhs, const Entry *rhs) {
+        return lhs->ch_y != rhs->ch_y ? lhs->ch_y < rhs->ch_y : lhs->ch_x < rhs->ch_x;
+    });
+    for (auto e: rows) {
+        ChunkCost c = sum(*e, tick);
+        fprintf(out, "%zu,%zu", e->ch_x, e->ch_y);
+        for (float v: c.values)
+            fprintf(out, ",%g", v);
+        fprintf(out, "\n");
+    }
+
+    bool ok = !ferror(out);
+    fclose(out);
+    if (!ok)
+        printf("FAILED TO WRITE %s\n", path.c_str());
+    return ok;
+}
+
+//black, red, yellow, white
+static void heat_colour(float t, unsigned char *rgb) {
+    t = std::min(std::max(t, 0.f), 1.f) * 3.f;
+    rgb[0] = static_cast<unsigned char>(std::min(t, 1.f) * 255.f);
+    rgb[1] = static_cast<unsigned char>(std::min(std::max(t - 1.f, 0.f), 1.f) * 255.f);
+    rgb[2] = static_cast<unsigned char>(std::min(std::max(t - 2.f, 0.f), 1.f) * 255.f);
+}
+
+bool ChunkCosts::write_ppm(const std::string &path, uint64_t tick, ChunkMetric metric) const {
+    Rect<int> r = bounds(tick);
+    int width = r.is_empty() ? 1 : r.width(), height = r.is_empty() ? 1 : r.height();
+    std::vector<float> values(static_cast<size_t>(width) * height, 0.f);
+    float top = 0.f;
+    if (!r.is_empty()) {
+        for (int y = r.top; y <= r.bottom; ++y) {
+            for (int x = r.left; x <= r.right; ++x) {
+                float v = get(x, y, tick)[metric];
+                values[(y - r.top) * width + x - r.left] = v;
+                top = std::max(top, v);
+            }
+        }
+    }
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        printf("FAILED TO OPEN %s\n", path.c_str());
+        return false;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(width * 3);
+    bool ok = true;
+    for (int y = 0; y < height && ok; ++y) {
+        for (int x = 0; x < width; ++x)
+            heat_colour(top > 0.f ? values[y * width + x] / top : 0.f, &row[3 * x]);
+        ok = fwrite(row.data(), 1, row.size(), f) == row.size();
+    }
+    fclose(f);
+    if (!ok)
+        printf("FAILED TO WRITE %s\n", path.c_str());
+    return ok;
+}
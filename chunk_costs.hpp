@@ -0,0 +1,76 @@
+#ifndef CHUNK_COSTS_HPP
+#define CHUNK_COSTS_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "rect.hpp"
+
+enum ChunkMetric {
+    //microseconds spent in update_chunk()
+    UpdateTime,
+    Tested,
+    Updated,
+    //cells redrawn, at full resolution
+    Redrawn,
+    //ticks the chunk was the last one of its group to finish updating
+    Straggler,
+    NUM_CHUNK_METRICS
+};
+
+const char* chunk_metric_name(ChunkMetric metric);
+
+struct ChunkCost {
+    float values[NUM_CHUNK_METRICS] = {};
+
+    float operator[](ChunkMetric metric) const { return values[metric]; }
+};
+
+//Where in the world the time goes: per chunk sums over the last WINDOW ticks.
+//The window is made of BUCKETS slices that get reused lazily, the chunks nobody touches cost nothing.
+//The chunks are indexed by their coordinates modulo the span (the resident ring), so a chunk
+//that takes over the cell of another starts from zero.
+//Each chunk must only be recorded into by one thread at a time, which the scheduler groups take care of;
+//reading it back while the workers are recording might miss the latest values.
+class ChunkCosts {
+public:
+    static const uint64_t BUCKET_TICKS = 16;
+    static const size_t BUCKETS = 4;
+    static const uint64_t WINDOW = BUCKET_TICKS * BUCKETS;
+
+    //in chunks
+    explicit ChunkCosts(size_t span);
+
+    void record(size_t ch_x, size_t ch_y, uint64_t tick, ChunkMetric metric, float value);
+    //the last WINDOW ticks up to the tick
+    ChunkCost get(size_t ch_x, size_t ch_y, uint64_t tick) const;
+    void clear();
+    size_t memory_bytes() const { return sizeof(ChunkCosts) + m_entries.capacity() * sizeof(Entry); }
+
+    //one row per chunk with any costs in the window
+    bool write_csv(const std::string &path, uint64_t tick) const;
+    //a pixel per chunk, black to red to yellow to white up to the largest value,
+    //over the chunks with any costs in the window
+    bool write_ppm(const std::string &path, uint64_t tick, ChunkMetric metric) const;
+
+private:
+    struct Entry {
+        size_t ch_x, ch_y;
+        //BUCKET_TICKS long slices of ticks, NEVER if unused
+        uint64_t epochs[BUCKETS];
+        float sums[BUCKETS][NUM_CHUNK_METRICS];
+    };
+    static const uint64_t NEVER = UINT64_MAX;
+
+    size_t m_span;
+    std::vector<Entry> m_entries;
+
+    Entry& entry(size_t ch_x, size_t ch_y);
+    const Entry& entry(size_t ch_x, size_t ch_y) const;
+    static ChunkCost sum(const Entry &e, uint64_t tick);
+    //of the chunks with any costs, empty if there are none
+    Rect<int> bounds(uint64_t tick) const;
+};
+
+#endif
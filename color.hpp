@@ -0,0 +1,32 @@
+#ifndef COLOR_HPP
+#define COLOR_HPP
+
+#include <cstdint>
+
+//an RGBA pixel; the same layout as sf::Color, so a frame can go to a texture as is
+struct Color {
+    uint8_t r, g, b, a;
+
+    constexpr Color() : r(0), g(0), b(0), a(255) {}
+    constexpr Color(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255)
+        : r(r), g(g), b(b), a(a)
+    {}
+
+    static const Color Black;
+    static const Color White;
+};
+
+inline constexpr Color Color::Black{ 0, 0, 0 };
+inline constexpr Color Color::White{ 255, 255, 255 };
+
+inline bool operator==(const Color &a, const Color &b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+inline bool operator!=(const Color &a, const Color &b) {
+    return !(a == b);
+}
+
+static_assert(sizeof(Color) == 4, "the pixels are tightly packed RGBA");
+
+#endif
@@ -0,0 +1,128 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "simulation.hpp"
+#include "frame_dumper.hpp"
+#include "world.hpp"
+
+//runs the same scenario under several scheduler setups in lockstep and compares the worlds after every tick:
+//  falling_stuff_consistency [ticks] [threads] [seed]
+//the first setup, no workers and the chunks in their natural order, is the reference;
+//on the first difference it tells the tick, the block and the chunk, and exits with 1.
+//A sand cloud falls a few thousand cells off screen, where it gets updated every few ticks.
+//Every so often the kept hashes get checked against hashing everything from scratch,
+//which catches the writes that don't mark their chunk dirty.
+
+const int WIDTH = 1024;
+const int HEIGHT = 512;
+//the camera moves right after a while, so the left part gets updated at a reduced rate
+//and the blocks on the right get streamed in
+const int CAMERA_TICK = 120;
+const int CAMERA_LEFT = 256;
+const int VERIFY_INTERVAL = 50;
+//the blocks down to this deep get loaded up front, for a long fall off screen at the reduced rate
+const int FALL_DEPTH = 8 * int(Block::SIZE);
+//the blocks looked through for the first difference
+const size_t SEARCH_BLOCKS = 8;
+
+struct Setup {
+    const char *name;
+    size_t num_threads;
+    bool reversed;
+};
+
+static void scenario(Simulation &sim) {
+    for (int top = 0; top < FALL_DEPTH; top += HEIGHT)
+        sim.set_camera(0, top, 0.f, 0.f);
+    sim.set_camera(0, 0, 0.f, 0.f);
+    //falls the whole way, fast enough to cross a chunk per update
+    sim.spawn_cloud(600, HEIGHT + 400, 30, ParticleType::Sand);
+    for (int x = 100; x < WIDTH; x += 300)
+        sim.spawn_cloud(x, 100, 70, ParticleType::Sand);
+    sim.spawn_cloud(WIDTH / 2, 120, 80, ParticleType::Water);
+    sim.spawn_cloud(800, 400, 60, ParticleType::Wood);
+    sim.spawn_cloud(800, 340, 4, ParticleType::Fire);
+    sim.spawn_cloud(150, HEIGHT - 60, 50, ParticleType::Wood);
+    sim.spawn_cloud(150, HEIGHT - 110, 4, ParticleType::Fire);
+}
+
+//narrows the difference down to the first chunk
+static void report(int tick, const Setup &setup, Simulation &ref, Simulation &sim) {
+    printf("%s: diverged in tick %d\n", setup.name, tick);
+    for (size_t blk_y = 0; blk_y < SEARCH_BLOCKS; ++blk_y) {
+        for (size_t blk_x = 0; blk_x < SEARCH_BLOCKS; ++blk_x) {
+            size_t ch_x = blk_x * Block::N, ch_y = blk_y * Block::N;
+            bool loaded = ref.is_chunk_loaded(ch_x, ch_y);
+            if (loaded != sim.is_chunk_loaded(ch_x, ch_y)) {
+                printf("  block (%zu, %zu) is resident in only one of them\n", blk_x, blk_y);
+                return;
+            }
+            if (!loaded || ref.block_hash(blk_x, blk_y) == sim.block_hash(blk_x, blk_y))
+                continue;
+            for (size_t j = ch_y; j < ch_y + Block::N; ++j)
+                for (size_t i = ch_x; i < ch_x + Block::N; ++i)
+                    if (ref.chunk_hash(i, j) != sim.chunk_hash(i, j)) {
+                        printf("  first in block (%zu, %zu), chunk (%zu, %zu), cells (%zu, %zu) - (%zu, %zu)\n",
+                                blk_x, blk_y, i, j, i * Chunk::SIZE, j * Chunk::SIZE,
+                                (i + 1) * Chunk::SIZE - 1, (j + 1) * Chunk::SIZE - 1);
+                        return;
+                    }
+        }
+    }
+    printf("  somewhere outside the first %zux%zu blocks\n", SEARCH_BLOCKS, SEARCH_BLOCKS);
+}
+
+int main(int argc, char **argv) {
+    int ticks = argc > 1 ? atoi(argv[1]) : 1000;
+    size_t num_threads = argc > 2 ? strtoul(argv[2], nullptr, 10) : 3;
+    uint32_t seed = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 1;
+    if (num_threads >= MAX_THREADS) {
+        printf("AT MOST %zu THREADS\n", MAX_THREADS - 1);
+        return 2;
+    }
+
+    const Setup setups[] = {
+        { "serial", 0, false },
+        { "parallel", num_threads, false },
+        { "serial reversed", 0, true },
+        { "parallel reversed", num_threads, true },
+    };
+    //nothing gets rendered
+    FrameDumper dumper("", 0);
+    std::vector<std::unique_ptr<Simulation>> sims;
+    for (auto &setup: setups) {
+        SimulationConfig config;
+        config.num_threads = setup.num_threads;
+        config.seed = seed;
+        config.hash_world = true;
+        config.reverse_chunk_order = setup.reversed;
+        sims.emplace_back(new Simulation(dumper, config));
+        scenario(*sims.back());
+    }
+
+    size_t n = sims.size();
+    for (int tick = 0; tick < ticks; ++tick) {
+        for (auto &sim: sims) {
+            if (tick == CAMERA_TICK)
+                sim->set_camera(CAMERA_LEFT, 0, 0.f, 0.f);
+            sim->update();
+        }
+        bool verify = tick % VERIFY_INTERVAL == VERIFY_INTERVAL - 1;
+        uint64_t ref = sims[0]->world_hash();
+        for (size_t i = 0; i < n; ++i) {
+            if (i && sims[i]->world_hash() != ref) {
+                report(tick, setups[i], *sims[0], *sims[i]);
+                return 1;
+            }
+            if (verify && sims[i]->world_hash() != sims[i]->compute_world_hash()) {
+                printf("%s: the kept hashes went stale by tick %d, a write didn't mark its chunk\n",
+                        setups[i].name, tick);
+                return 1;
+            }
+        }
+    }
+    printf("%d ticks, %zu setups (up to %zu threads), seed %u: all the same, world hash %016llx\n",
+            ticks, n, num_threads, seed, static_cast<unsigned long long>(sims[0]->world_hash()));
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "edit.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+Edit Edit::circle(int cx, int cy, int r, ParticleType type) {
+    Edit e;
+    e.shape = Circle;
+    e.type = type;
+    e.x = cx;
+    e.y = cy;
+    e.r = r;
+    return e;
+}
+
+Edit Edit::box(int left, int top, int right, int bottom, ParticleType type) {
+    Edit e;
+    e.shape = Box;
+    e.type = type;
+    e.x = std::min(left, right);
+    e.y = std::min(top, bottom);
+    e.xx = std::max(left, right);
+    e.yy = std::max(top, bottom);
+    return e;
+}
+
+Edit Edit::line(int x, int y, int xx, int yy, int r, ParticleType type) {
+    Edit e;
+    e.shape = Line;
+    e.type = type;
+    e.x = x;
+    e.y = y;
+    e.xx = xx;
+    e.yy = yy;
+    e.r = r;
+    return e;
+}
+
+Edit Edit::polygon(std::vector<Point> points, ParticleType type) {
+    Edit e;
+    e.shape = Polygon;
+    e.type = type;
+    e.points = std::move(points);
+    return e;
+}
+
+Edit Edit::stamp(int left, int top, int width, int height, std::vector<ParticleType> cells, bool opaque) {
+    assert(cells.size() == static_cast<size_t>(width) * height);
+    Edit e;
+    e.shape = Stamp;
+    e.x = left;
+    e.y = top;
+    e.width = width;
+    e.height = height;
+    e.cells = std::move(cells);
+    e.opaque = opaque;
+    return e;
+}
+
+Rect<int> Edit::bounds() const {
+    Rect<int> res;
+    res.reset();
+    switch (shape) {
+    case Circle:
+        if (r >= 0)
+            res = Rect<int>(x - r, y - r, x + r, y + r);
+        break;
+    case Box:
+        res = Rect<int>(x, y, xx, yy);
+        break;
+    case Line:
+        res = Rect<int>(std::min(x, xx) - r, std::min(y, yy) - r, std::max(x, xx) + r, std::max(y, yy) + r);
+        break;
+    case Polygon:
+        for (auto &p: points)
+            res.include<false>(p.x, p.y);
+        break;
+    case Stamp:
+        if (width > 0 && height > 0)
+            res = Rect<int>(x, y, x + width - 1, y + height - 1);
+        break;
+    }
+    return res;
+}
+
+//where a x + b falls into [lo, hi]
+static bool solve_range(double a, double b, double lo, double hi, double &x0, double &x1) {
+    if (a == 0.0) {
+        x0 = -HUGE_VAL;
+        x1 = HUGE_VAL;
+        return b >= lo && b <= hi;
+    }
+    x0 = (lo - b) / a;
+    x1 = (hi - b) / a;
+    if (x0 > x1)
+        std::swap(x0, x1);
+    return true;
+}
+
+void Edit::row_spans(int row, std::vector<std::pair<int, int>> &out, std::vector<double> &crossings) const {
+    switch (shape) {
+    case Circle: {
+        //the cells no further than r from the centre, as spawn_cloud() always had it
+        long long dy = row - y, rr = static_cast<long long>(r) * r;
+        if (r < 0 || dy * dy > rr)
+            return;
+        long long w = static_cast<long long>(std::sqrt(static_cast<double>(rr - dy * dy)));
+        while (w * w + dy * dy > rr)
+            --w;
+        while ((w + 1) * (w + 1) + dy * dy <= rr)
+            ++w;
+        out.emplace_back(x - static_cast<int>(w), x + static_cast<int>(w));
+        return;
+    }
+    case Box:
+    case Stamp: {
+        Rect<int> b = bounds();
+        if (!b.is_empty() && row >= b.top && row <= b.bottom)
+            out.emplace_back(b.left, b.right);
+        return;
+    }
+    case Line: {
+        //a capsule: the cells within r + 1/2 of the segment, so a line 0 wide has no gaps;
+        //it's convex, so every row is a single span, the hull of the end caps and the band in between
+        double rad = r + 0.5, lo = HUGE_VAL, hi = -HUGE_VAL;
+        for (auto &end: { Point{ x, y }, Point{ xx, yy } }) {
+            double dy = row - end.y;
+            if (dy * dy > rad * rad)
+                continue;
+            double w = std::sqrt(rad * rad - dy * dy);
+            lo = std::min(lo, end.x - w);
+            hi = std::max(hi, end.x + w);
+        }
+        double dx = xx - x, dy = yy - y, len2 = dx * dx + dy * dy;
+        if (len2 > 0.0) {
+            double len = std::sqrt(len2), oy = row - y;
+            double t0, t1, c0, c1;
+            //along the segment, 0 to 1; across it, -rad to rad
+            if (solve_range(dx / len2, -x * dx / len2 + oy * dy / len2, 0.0, 1.0, t0, t1)
+                    && solve_range(dy / len, -x * dy / len - oy * dx / len, -rad, rad, c0, c1)) {
+                double b0 = std::max(t0, c0), b1 = std::min(t1, c1);
+                if (b0 <= b1) {
+                    lo = std::min(lo, b0);
+                    hi = std::max(hi, b1);
+                }
+            }
+        }
+        if (lo > hi)
+            return;
+        int x0 = static_cast<int>(std::ceil(lo)), x1 = static_cast<int>(std::floor(hi));
+        if (x0 <= x1)
+            out.emplace_back(x0, x1);
+        return;
+    }
+    case Polygon: {
+        //where the edges cross the row, the cells between every other pair of crossings are in
+        size_t first = out.size();
+        auto &xs = crossings;
+        xs.clear();
+        for (size_t i = 0, n = points.size(); i < n; ++i) {
+            const Point &a = points[i], &b = points[(i + 1) % n];
+            //half-open, so a vertex on the row counts once
+            if ((a.y <= row) == (b.y <= row))
+                continue;
+            xs.push_back(a.x + static_cast<double>(row - a.y) * (b.x - a.x) / (b.y - a.y));
+        }
+        std::sort(xs.begin(), xs.end());
+        for (size_t i = 0; i + 1 < xs.size(); i += 2) {
+            //half-open like the rows, so polygons sharing an edge don't overlap
+            int x0 = static_cast<int>(std::ceil(xs[i])), x1 = static_cast<int>(std::ceil(xs[i + 1])) - 1;
+            if (x0 > x1)
+                continue;
+            //touching spans get merged, the caller wants them apart
+            if (out.size() > first && out.back().second >= x0 - 1)
+                out.back().second = std::max(out.back().second, x1);
+            else
+                out.emplace_back(x0, x1);
+        }
+        return;
+    }
+    }
+}
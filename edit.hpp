@@ -0,0 +1,54 @@
+#ifndef EDIT_HPP
+#define EDIT_HPP
+
+#include <vector>
+#include <utility>
+#include "particle.hpp"
+#include "rect.hpp"
+
+//A shape filled with one type of particle, or a stamp of several; see Simulation::queue_edit().
+//The coordinates are world cells, whatever isn't loaded gets clipped.
+struct Edit {
+    enum Shape {
+        Circle,
+        Box,
+        Line,
+        Polygon,
+        Stamp,
+    };
+
+    struct Point {
+        int x, y;
+    };
+
+    Shape shape = Circle;
+    ParticleType type = ParticleType::None;
+    //Circle: the centre and the radius; Box: the opposite corners, inclusive;
+    //Line: the ends and the half-width, 0 is one cell wide; Stamp: the top left corner
+    int x = 0, y = 0, xx = 0, yy = 0, r = 0;
+    //Polygon: the vertices in order, filled even-odd; like the rows, the cells are half-open,
+    //so polygons sharing an edge don't overlap
+    std::vector<Point> points;
+    //Stamp: width x height types row by row; the None cells are left alone unless it's opaque
+    int width = 0, height = 0;
+    std::vector<ParticleType> cells;
+    bool opaque = false;
+
+    static Edit circle(int cx, int cy, int r, ParticleType type);
+    static Edit box(int left, int top, int right, int bottom, ParticleType type);
+    static Edit line(int x, int y, int xx, int yy, int r, ParticleType type);
+    static Edit polygon(std::vector<Point> points, ParticleType type);
+    static Edit stamp(int left, int top, int width, int height, std::vector<ParticleType> cells,
+            bool opaque = false);
+
+    //everything it might cover, empty if nothing
+    Rect<int> bounds() const;
+    //appends the covered cells of the row as inclusive spans, left to right and not overlapping;
+    //for a stamp that's the whole row of it. The polygons use crossings as scratch space,
+    //so it doesn't get allocated for every row
+    void row_spans(int row, std::vector<std::pair<int, int>> &out, std::vector<double> &crossings) const;
+    //the type of a stamp cell within its bounds
+    ParticleType stamp_cell(int x, int y) const { return cells[(y - this->y) * width + x - this->x]; }
+};
+
+#endif
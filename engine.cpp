@@ -0,0 +1,57 @@
+#include "engine.hpp"
+#include <cstring>
+#include <cassert>
+
+void Engine::FrameSink::create(int width, int height) {
+    this->width = width;
+    this->height = height;
+    pixels.assign(static_cast<size_t>(width) * height, Color::Black);
+}
+
+void Engine::FrameSink::update(const Color *pixels, int y, int yy) {
+    assert(y >= 0 && yy < height && y <= yy);
+    memcpy(&this->pixels[static_cast<size_t>(y) * width], pixels,
+            static_cast<size_t>(yy - y + 1) * width * sizeof(Color));
+}
+
+Engine::Engine(const SimulationConfig &config)
+    : m_sim(new Simulation(m_sink, config))
+{}
+
+Engine::~Engine() = default;
+
+void Engine::step(int ticks) {
+    //the redraw rects accumulate, only the last tick needs rendering
+    for (int i = 0; i < ticks; ++i)
+        m_sim->update();
+    m_sim->render();
+}
+
+uint64_t Engine::tick() const {
+    return m_sim->tick();
+}
+
+void Engine::edit(Edit edit) {
+    m_sim->queue_edit(std::move(edit));
+}
+
+void Engine::edit(std::vector<Edit> edits) {
+    m_sim->queue_edits(std::move(edits));
+}
+
+Particle Engine::particle(int x, int y) const {
+    return m_sim->get_particle(x, y);
+}
+
+void Engine::set_camera(int left, int top) {
+    m_sim->set_camera(left, top, 0.f, 0.f);
+}
+
+const Rect<size_t>& Engine::view() const {
+    return m_sim->view();
+}
+
+void Engine::set_lod(int lod) {
+    assert(lod >= 0);
+    m_sim->set_zoom(static_cast<float>(1 << lod));
+}
@@ -0,0 +1,66 @@
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "simulation.hpp"
+#include "pixel_sink.hpp"
+#include "color.hpp"
+#include "edit.hpp"
+#include "particle.hpp"
+#include "rect.hpp"
+
+//The simulation for embedding: a world, the ticks, the edits and the finished image,
+//with no window and no SFML. Whatever isn't covered here is available through simulation().
+//Only edit() may be called from other threads.
+class Engine {
+public:
+    explicit Engine(const SimulationConfig &config = SimulationConfig());
+    ~Engine();
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    //runs the ticks and renders the last one
+    void step(int ticks = 1);
+    uint64_t tick() const;
+
+    //applied at the start of the next tick
+    void edit(Edit edit);
+    void edit(std::vector<Edit> edits);
+
+    //world coordinates; an empty particle wherever nothing is loaded
+    Particle particle(int x, int y) const;
+    ParticleType type(int x, int y) const { return particle(x, y).type(); }
+
+    //the top left corner of the rendered area, the world gets streamed in around it
+    void set_camera(int left, int top);
+    const Rect<size_t>& view() const;
+    //each level halves the image, up to RenderBuffer::NUM_LODS - 1
+    void set_lod(int lod);
+
+    //the image of the view after the last step(), width() x height() RGBA pixels row by row
+    const Color* pixels() const { return m_sink.pixels.data(); }
+    int width() const { return m_sink.width; }
+    int height() const { return m_sink.height; }
+
+    Simulation& simulation() { return *m_sim; }
+    const Simulation& simulation() const { return *m_sim; }
+
+private:
+    //keeps the last frame
+    struct FrameSink : PixelSink {
+        std::vector<Color> pixels;
+        int width = 0, height = 0;
+
+        void create(int width, int height) override;
+        void update(const Color *pixels, int y, int yy) override;
+    };
+
+    //must outlive the simulation
+    FrameSink m_sink;
+    std::unique_ptr<Simulation> m_sim;
+};
+
+#endif
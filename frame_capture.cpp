@@ -0,0 +1,152 @@
+#include "frame_capture.hpp"
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+FrameCapture::FrameCapture(const std::string &path, int width, int height,
+        Format format, size_t num_slots, int fps)
+    : m_width(width), m_height(height), m_format(format), 
+      m_head(0), m_tail(0), m_captured(0), m_dropped(0), m_written(0), m_stop(false)
+{
+    m_file = fopen(path.c_str(), "wb");
+    if (!m_file) {
+        printf("FAILED TO OPEN %s\n", path.c_str());
+        return;
+    }
+
+    switch (m_format) {
+    case Y4M:
+        fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+        break;
+    case DeltaRLE:
+        fprintf(m_file, "FSRLE1 %d %d\n", width, height);
+        break;
+    default:
+        break;
+    };
+
+    m_slots.resize(std::max<size_t>(num_slots, 2));
+    for (auto &s: m_slots)
+        s.resize(width * height);
+    m_writer = std::thread(&FrameCapture::writer_routine, this);
+}
+
+bool FrameCapture::push(const Color *pixels, int width, int height) {
+    if (!m_file || width != m_width || height != m_height) {
+        ++m_dropped;
+        return false;
+    }
+
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t next = (head + 1) % m_slots.size();
+    if (next == m_tail.load(std::memory_order_acquire)) {
+        ++m_dropped;
+        return false;
+    }
+
+    memcpy(m_slots[head].data(), pixels, m_slots[head].size() * sizeof(Color));
+    m_head.store(next, std::memory_order_release);
+    ++m_captured;
+    m_cv.notify_one();
+    return true;
+}
+
+FrameCapture::~FrameCapture() {
+    if (!m_file)
+        return;
+    m_stop = true;
+    m_cv.notify_one();
+    m_writer.join();
+    fclose(m_file);
+}
+
+void FrameCapture::writer_routine() {
+    while (true) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) {
+            if (m_stop)
+                break;
+            //the producer doesn't take the lock, so a wakeup can be missed; hence the timeout
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait_for(lock, std::chrono::milliseconds(5));
+            continue;
+        }
+
+        write_frame(m_slots[tail]);
+        m_tail.store((tail + 1) % m_slots.size(), std::memory_order_release);
+        ++m_written;
+    }
+    fflush(m_file);
+}
+
+void FrameCapture::write_frame(const std::vector<Color> &frame) {
+    m_out.clear();
+    switch (m_format) {
+    case Y4M:
+        encode_y4m(frame);
+        break;
+    case RawRGB:
+        encode_rgb(frame);
+        break;
+    case DeltaRLE:
+        encode_delta_rle(frame);
+        break;
+    default:
+        break;
+    };
+    fwrite(m_out.data(), 1, m_out.size(), m_file);
+}
+
+void FrameCapture::encode_y4m(const std::vector<Color> &frame) {
+    const char *tag = "FRAME\n";
+    m_out.insert(m_out.end(), tag, tag + strlen(tag));
+
+    size_t n = frame.size(), base = m_out.size();
+    m_out.resize(base + 3 * n);
+    uint8_t *y = &m_out[base], *u = y + n, *v = u + n;
+    //BT.601, studio swing
+    for (size_t i = 0; i < n; ++i) {
+        int r = frame[i].r, g = frame[i].g, b = frame[i].b;
+        y[i] = static_cast<uint8_t>((( 66 * r + 129 * g +  25 * b + 128) >> 8) +  16);
+        u[i] = static_cast<uint8_t>(((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128);
+        v[i] = static_cast<uint8_t>(((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+    }
+}
+
+void FrameCapture::encode_rgb(const std::vector<Color> &frame) {
+    m_out.resize(3 * frame.size());
+    for (size_t i = 0; i < frame.size(); ++i) {
+        m_out[3 * i + 0] = frame[i].r;
+        m_out[3 * i + 1] = frame[i].g;
+        m_out[3 * i + 2] = frame[i].b;
+    }
+}
+
+void FrameCapture::encode_delta_rle(const std::vector<Color> &frame) {
+    auto same = [](const Color &a, const Color &b) {
+        return a.r == b.r && a.g == b.g && a.b == b.b;
+    };
+
+    bool has_prev = m_prev.size() == frame.size();
+    for (int y = 0; y < m_height; ++y) {
+        const Color *row = &frame[y * m_width];
+        if (has_prev && std::equal(row, row + m_width, &m_prev[y * m_width], same)) {
+            m_out.push_back(0);
+            continue;
+        }
+
+        m_out.push_back(1);
+        for (int x = 0; x < m_width;) {
+            int len = 1;
+            while (x + len < m_width && len < UINT16_MAX && same(row[x + len], row[x]))
+                ++len;
+            m_out.push_back(static_cast<uint8_t>(len & 0xFF));
+            m_out.push_back(static_cast<uint8_t>(len >> 8));
+            m_out.push_back(row[x].r);
+            m_out.push_back(row[x].g);
+            m_out.push_back(row[x].b);
+            x += len;
+        }
+    }
+    m_prev = frame;
+}
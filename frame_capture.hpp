@@ -0,0 +1,73 @@
+#ifndef FRAME_CAPTURE_HPP
+#define FRAME_CAPTURE_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include "color.hpp"
+
+//Records finished frames to a file for later review.
+//push() copies a frame into a ring of preallocated slots and never blocks:
+//if the writer thread falls behind, the frame gets dropped and counted.
+class FrameCapture {
+public:
+    enum Format {
+        //YUV4MPEG2, 4:4:4, playable with ffplay / mpv
+        Y4M,
+        //headerless rgb24, ffplay -f rawvideo -pixel_format rgb24 -video_size WxH
+        RawRGB,
+        //"FSRLE1 <w> <h>\n" followed by the frames; each row starts with a tag byte:
+        //0 - same as in the previous frame,
+        //1 - runs of (uint16 little-endian length, r, g, b) covering the whole row
+        DeltaRLE,
+    };
+
+    FrameCapture(const std::string &path, int width, int height,
+            Format format = Y4M, size_t num_slots = 16, int fps = 60);
+
+    bool is_open() const { return m_file != nullptr; }
+
+    //only frames matching the capture size are accepted, others count as dropped;
+    //returns false if the frame got dropped
+    bool push(const Color *pixels, int width, int height);
+
+    size_t num_captured() const { return m_captured; }
+    size_t num_dropped() const { return m_dropped; }
+    size_t num_written() const { return m_written; }
+
+    //writes out the frames that are still queued
+    ~FrameCapture();
+
+private:
+    FILE *m_file;
+    int m_width, m_height;
+    Format m_format;
+
+    //single producer / single consumer ring, one slot always stays empty
+    std::vector<std::vector<Color>> m_slots;
+    std::atomic<size_t> m_head, m_tail;
+
+    std::atomic<size_t> m_captured, m_dropped, m_written;
+    std::atomic<bool> m_stop;
+
+    std::thread m_writer;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+
+    //writer state
+    std::vector<uint8_t> m_out;
+    std::vector<Color> m_prev;
+
+    void writer_routine();
+    void write_frame(const std::vector<Color> &frame);
+
+    void encode_y4m(const std::vector<Color> &frame);
+    void encode_rgb(const std::vector<Color> &frame);
+    void encode_delta_rle(const std::vector<Color> &frame);
+};
+
+#endif
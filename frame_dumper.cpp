@@ -0,0 +1,116 @@
+#include "frame_dumper.hpp"
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+FrameDumper::FrameDumper(std::string prefix, size_t interval)
+    : m_prefix(std::move(prefix)), m_interval(interval), m_frame(0),
+      m_width(0), m_height(0), m_pending_width(0), m_pending_height(0),
+      m_pending_frame(0), m_has_pending(false),
+      m_stop(false), m_dumped(0), m_skipped(0)
+{
+    m_writer = std::thread(&FrameDumper::writer_routine, this);
+}
+
+void FrameDumper::create(int width, int height) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_width = width;
+    m_height = height;
+    m_pixels.assign(width * height, Color::Black);
+}
+
+void FrameDumper::update(const Color *pixels, int y, int yy) {
+    assert(y >= 0 && yy < m_height && y <= yy);
+    memcpy(&m_pixels[y * m_width], pixels, (yy - y + 1) * m_width * sizeof(Color));
+    //the frame is complete once its last row has arrived
+    if (yy != m_height - 1)
+        return;
+
+    size_t frame = m_frame++;
+    if (!m_interval || frame % m_interval)
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (m_has_pending) {
+        ++m_skipped;
+        return;
+    }
+    m_pending.assign(m_pixels.begin(), m_pixels.end());
+    m_pending_width = m_width;
+    m_pending_height = m_height;
+    m_pending_frame = frame;
+    m_has_pending = true;
+    lock.unlock();
+    m_cv.notify_one();
+}
+
+size_t FrameDumper::num_dumped() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_dumped;
+}
+
+size_t FrameDumper::num_skipped() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_skipped;
+}
+
+FrameDumper::~FrameDumper() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+    m_writer.join();
+}
+
+void FrameDumper::writer_routine() {
+    std::vector<Color> frame_pixels;
+    while (true) {
+        size_t frame;
+        int width, height;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this]() { return m_has_pending || m_stop; });
+            //flush the last pending frame before quitting
+            if (!m_has_pending)
+                break;
+            frame_pixels.swap(m_pending);
+            frame = m_pending_frame;
+            width = m_pending_width;
+            height = m_pending_height;
+        }
+
+        bool ok = write_ppm(frame_pixels, width, height, frame);
+
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_has_pending = false;
+        m_dumped += ok;
+    }
+}
+
+bool FrameDumper::write_ppm(const std::vector<Color> &pixels, int width, int height,
+        size_t frame) const 
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s%06zu.ppm", m_prefix.c_str(), frame);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("FAILED TO OPEN %s\n", path);
+        return false;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(width * 3);
+    bool ok = true;
+    for (int y = 0; y < height && ok; ++y) {
+        const Color *src = &pixels[y * width];
+        for (int x = 0; x < width; ++x) {
+            row[3 * x + 0] = src[x].r;
+            row[3 * x + 1] = src[x].g;
+            row[3 * x + 2] = src[x].b;
+        }
+        ok = fwrite(row.data(), 1, row.size(), f) == row.size();
+    }
+    fclose(f);
+    return ok;
+}
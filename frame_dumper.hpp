@@ -0,0 +1,56 @@
+#ifndef FRAME_DUMPER_HPP
+#define FRAME_DUMPER_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "pixel_sink.hpp"
+
+//a pure-CPU sink that doesn't need a GL context;
+//every n-th complete frame gets written to <prefix><frame>.ppm from a background thread
+class FrameDumper : public PixelSink {
+public:
+    //interval == 0 disables dumping altogether
+    FrameDumper(std::string prefix, size_t interval);
+
+    void create(int width, int height) override;
+    void update(const Color *pixels, int y, int yy) override;
+
+    size_t num_frames() const { return m_frame; }
+    size_t num_dumped() const;
+    //frames that were due, but got skipped because the writer was still busy
+    size_t num_skipped() const;
+
+    const std::vector<Color>& pixels() const { return m_pixels; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    ~FrameDumper();
+
+private:
+    std::string m_prefix;
+    size_t m_interval;
+    size_t m_frame;
+
+    int m_width, m_height;
+    std::vector<Color> m_pixels;
+
+    //handed over to the writer
+    std::vector<Color> m_pending;
+    int m_pending_width, m_pending_height;
+    size_t m_pending_frame;
+    bool m_has_pending, m_stop;
+    size_t m_dumped, m_skipped;
+
+    std::thread m_writer;
+    mutable std::mutex m_mtx;
+    std::condition_variable m_cv;
+
+    void writer_routine();
+    bool write_ppm(const std::vector<Color> &pixels, int width, int height,
+            size_t frame) const;
+};
+
+#endif
@@ -1,8 +1,35 @@
 #include "grid_painter.hpp"
 #include <SFML/Graphics/RenderTarget.hpp>
+#include <algorithm>
 
 using V2f = sf::Vector2f;
 
+const sf::Color NEXT_RECT_COLOR = sf::Color::Red;
+const sf::Color CUR_RECT_COLOR = sf::Color::Green;
+const sf::Color REDRAW_RECT_COLOR = sf::Color::Cyan;
+
+static void add_outline(std::vector<sf::Vertex> &v, float left, float top,
+        float right, float bottom, const sf::Color &color)
+{
+    v.emplace_back(V2f(left, top), color);
+    v.emplace_back(V2f(right, top), color);
+
+    v.emplace_back(V2f(right, top), color);
+    v.emplace_back(V2f(right, bottom), color);
+
+    v.emplace_back(V2f(right, bottom), color);
+    v.emplace_back(V2f(left, bottom), color);
+
+    v.emplace_back(V2f(left, bottom), color);
+    v.emplace_back(V2f(left, top), color);
+}
+
+static void add_outline(std::vector<sf::Vertex> &v, const Rect<int> &r, const sf::Color &color) {
+    if (r.is_empty())
+        return;
+    add_outline(v, float(r.left), float(r.top), float(r.right + 1), float(r.bottom + 1), color);
+}
+
 void GridPainter::update(int width, int height, float cell_width, 
         float cell_height, const sf::Color &color) 
 {
@@ -10,45 +37,111 @@ void GridPainter::update(int width, int height, float cell_width,
     m_height = height;
     m_cell_width = cell_width;
     m_cell_height = cell_height;
+    m_color = color;
+
+    Cell empty;
+    empty.next.reset();
+    empty.cur.reset();
+    empty.redraw.reset();
+    empty.heat = 0;
+    m_cells.assign(width * height, empty);
 
     update_vertices(color);
 }
 
 void GridPainter::clear_selection() {
     m_selected.clear();
+    m_dirty = true;
 }
 
 void GridPainter::add_selection(int x, int y, const sf::Color &color) {
     float left = x * m_cell_width, top = y * m_cell_height,
           right = (x + 1) * m_cell_width, bottom = (y + 1) * m_cell_height;
-    m_selected.emplace_back(V2f(left, top), color);
-    m_selected.emplace_back(V2f(right, top), color);
+    add_outline(m_selected, left, top, right, bottom, color);
+    m_dirty = true;
+}
 
-    m_selected.emplace_back(V2f(right, top), color);
-    m_selected.emplace_back(V2f(right, bottom), color);
+void GridPainter::set_cell(int x, int y, const Rect<int> &next, const Rect<int> &cur,
+        const Rect<int> &redraw, float heat)
+{
+    Cell &c = m_cells[y * m_width + x];
+    uint8_t q = static_cast<uint8_t>(std::min(std::max(heat, 0.f), 1.f) * 255.f);
+    if (c.next == next && c.cur == cur && c.redraw == redraw && c.heat == q)
+        return;
+    c.next = next;
+    c.cur = cur;
+    c.redraw = redraw;
+    c.heat = q;
+    m_dirty = true;
+}
 
-    m_selected.emplace_back(V2f(right, bottom), color);
-    m_selected.emplace_back(V2f(left, bottom), color);
+void GridPainter::set_origin(float x, float y) {
+    if (x == m_origin_x && y == m_origin_y)
+        return;
+    m_origin_x = x;
+    m_origin_y = y;
+    update_vertices(m_color);
+}
 
-    m_selected.emplace_back(V2f(left, bottom), color);
-    m_selected.emplace_back(V2f(left, top), color);
+void GridPainter::set_layers(int layers) {
+    if (layers == m_layers)
+        return;
+    m_layers = layers;
+    m_dirty = true;
 }
 
 void GridPainter::update_vertices(const sf::Color &color) {
     m_vertices.clear();
+    float x = m_origin_x, y = m_origin_y;
     for (int i = 0; i <= m_width; ++i) {
-        m_vertices.emplace_back(V2f(i * m_cell_width, 0.f), color);
-        m_vertices.emplace_back(V2f(i * m_cell_width, m_height * m_cell_height), color);
+        m_vertices.emplace_back(V2f(x + i * m_cell_width, y), color);
+        m_vertices.emplace_back(V2f(x + i * m_cell_width, y + m_height * m_cell_height), color);
     }
 
     for (int i = 0; i <= m_height; ++i) {
-        m_vertices.emplace_back(V2f(0.f, i * m_cell_height), color);
-        m_vertices.emplace_back(V2f(m_width * m_cell_width, i * m_cell_height), color);
+        m_vertices.emplace_back(V2f(x, y + i * m_cell_height), color);
+        m_vertices.emplace_back(V2f(x + m_width * m_cell_width, y + i * m_cell_height), color);
     }
+    m_dirty = true;
 }
 
-void GridPainter::draw(sf::RenderTarget &target, sf::RenderStates states) const {
-    target.draw(m_vertices.data(), m_vertices.size(), sf::Lines, states);
-    target.draw(m_selected.data(), m_selected.size(), sf::Lines, states);
+void GridPainter::rebuild() const {
+    m_lines.clear();
+    m_quads.clear();
+
+    if (m_layers & Grid)
+        m_lines.insert(m_lines.end(), m_vertices.begin(), m_vertices.end());
+    m_lines.insert(m_lines.end(), m_selected.begin(), m_selected.end());
+
+    for (int y = 0; y < m_height; ++y) {
+        for (int x = 0; x < m_width; ++x) {
+            const Cell &c = m_cells[y * m_width + x];
+            if (m_layers & NextRects)
+                add_outline(m_lines, c.next, NEXT_RECT_COLOR);
+            if (m_layers & CurRects)
+                add_outline(m_lines, c.cur, CUR_RECT_COLOR);
+            if (m_layers & RedrawRects)
+                add_outline(m_lines, c.redraw, REDRAW_RECT_COLOR);
+
+            if ((m_layers & Heat) && c.heat) {
+                float left = m_origin_x + x * m_cell_width, top = m_origin_y + y * m_cell_height,
+                      right = left + m_cell_width, bottom = top + m_cell_height;
+                sf::Color color(255, 0, 0, c.heat / 2);
+                m_quads.emplace_back(V2f(left, top), color);
+                m_quads.emplace_back(V2f(right, top), color);
+                m_quads.emplace_back(V2f(right, bottom), color);
+                m_quads.emplace_back(V2f(left, bottom), color);
+            }
+        }
+    }
+
+    m_dirty = false;
 }
 
+void GridPainter::draw(sf::RenderTarget &target, sf::RenderStates states) const {
+    if (m_dirty)
+        rebuild();
+    if (!m_quads.empty())
+        target.draw(m_quads.data(), m_quads.size(), sf::Quads, states);
+    target.draw(m_lines.data(), m_lines.size(), sf::Lines, states);
+}
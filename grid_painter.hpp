@@ -1,10 +1,22 @@
 #include <SFML/Graphics/Vertex.hpp>
 #include <SFML/Graphics/Drawable.hpp>
 #include <vector>
+#include "rect.hpp"
 
 
+//Debug overlay: the grid, per-cell rects and a heat colour, all batched
+//into two vertex arrays that only get rebuilt when something changes.
 class GridPainter : public sf::Drawable {
 public:
+    enum Layer {
+        Grid = 1,
+        NextRects = 2,
+        CurRects = 4,
+        RedrawRects = 8,
+        Heat = 16,
+        AllLayers = 31,
+    };
+
     GridPainter() = default;
 
     void update(int width, int height, float cell_width, float cell_height,
@@ -13,14 +25,39 @@ public:
     void clear_selection();
     void add_selection(int x, int y, const sf::Color &color = sf::Color::Red);
 
+    //rects are in absolute coordinates, heat is in [0, 1]
+    void set_cell(int x, int y, const Rect<int> &next, const Rect<int> &cur,
+            const Rect<int> &redraw, float heat);
+
+    //where the top left corner of the grid is
+    void set_origin(float x, float y);
+
+    void set_layers(int layers);
+    int layers() const { return m_layers; }
+
 private:
+    struct Cell {
+        Rect<int> next, cur, redraw;
+        //quantized, so tiny fluctuations don't trigger a rebuild
+        uint8_t heat;
+    };
+
     std::vector<sf::Vertex> m_vertices;
     std::vector<sf::Vertex> m_selected;
     int m_width = 0, m_height = 0;
     float m_cell_width = 0.f, m_cell_height = 0.f;
+    float m_origin_x = 0.f, m_origin_y = 0.f;
+    sf::Color m_color;
+
+    std::vector<Cell> m_cells;
+    int m_layers = AllLayers;
+    //the batches get rebuilt lazily on the next draw
+    mutable bool m_dirty = true;
+    mutable std::vector<sf::Vertex> m_lines;
+    mutable std::vector<sf::Vertex> m_quads;
 
     void update_vertices(const sf::Color &color);
+    void rebuild() const;
 
     virtual void draw(sf::RenderTarget &target, sf::RenderStates states) const override;
 };
-
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "simulation.hpp"
+#include "frame_dumper.hpp"
+#include "frame_capture.hpp"
+
+static void print_rates(const char *name, const PerfSample &s, long long updated, long long tested) {
+    if (!s.mask) {
+        printf("%-10s n/a\n", name);
+        return;
+    }
+    printf("%-10s", name);
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        auto counter = static_cast<PerfCounter>(i);
+        if (s.has(counter))
+            printf(" %s %.2f/%.2f", perf_counter_name(counter), 
+                    double(s.values[i]) / std::max(updated, 1LL), double(s.values[i]) / std::max(tested, 1LL));
+    }
+    if (s.has(Cycles) && s.has(Instructions) && s.values[Cycles])
+        printf(" ipc %.2f", double(s.values[Instructions]) / s.values[Cycles]);
+    printf("\n");
+}
+
+static void print_percentiles(const char *name, const Histogram &h) {
+    Percentiles p = h.percentiles(1e-3f);
+    printf("%-10s %7.3f %7.3f %7.3f %7.3f %7.3f\n", name, p.p50, p.p90, p.p99, p.p999, p.max);
+}
+
+static void print_latencies(const Simulation &sim) {
+    const auto &phases = sim.phase_histograms();
+    printf("update latencies, ms:\n%-10s %7s %7s %7s %7s %7s\n", "", "p50", "p90", "p99", "p99.9", "max");
+    print_percentiles("total", phases.total);
+    print_percentiles("io", phases.io);
+    print_percentiles("edit", phases.edit);
+    print_percentiles("propagate", phases.propagate);
+    print_percentiles("schedule", phases.schedule);
+    print_percentiles("prepare", phases.prepare);
+    print_percentiles("update", phases.update);
+    print_percentiles("hash", phases.hash);
+    for (size_t t = 0; t <= sim.num_threads(); ++t) {
+        char name[32];
+        snprintf(name, sizeof(name), "busy #%zu", t);
+        print_percentiles(name, sim.busy_histogram(t));
+    }
+}
+
+//per updated / tested particle, summed over the threads; then the update phase of each thread
+static void print_perf(const Simulation &sim, long long updated, long long tested) {
+    const char *names[] = { "propagate", "prepare", "update", "render", "hash", "edit" };
+    printf("hardware counters per updated / tested particle:\n");
+    for (int mode = 0; mode < scheduler::NUM_MODES; ++mode) {
+        PerfSample total;
+        for (size_t t = 0; t <= sim.num_threads(); ++t)
+            total += sim.perf_totals(t, static_cast<scheduler::Mode>(mode));
+        print_rates(names[mode], total, updated, tested);
+    }
+    print_rates("flush", sim.flush_perf_totals(), updated, tested);
+    for (size_t t = 0; t <= sim.num_threads(); ++t) {
+        char name[32];
+        snprintf(name, sizeof(name), "update #%zu", t);
+        print_rates(name, sim.perf_totals(t, scheduler::Update), updated, tested);
+    }
+}
+
+//runs the simulation without a window or a GL context:
+//  falling_stuff_headless [ticks] [dump every n-th frame, 0 = never] [threads] [prefix] [capture.y4m, - = none]
+//      [trace.json, - = none] [hardware counters, 1 = on] [chunk costs prefix, - = none]
+int main(int argc, char **argv) {
+    int ticks = argc > 1 ? atoi(argv[1]) : 3600;
+    size_t interval = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+    size_t num_threads = argc > 3 ? strtoul(argv[3], nullptr, 10) : 3;
+    const char *prefix = argc > 4 ? argv[4] : "frame_";
+
+    //only the frames to be dumped get rendered, so the dumper takes every frame it gets
+    FrameDumper dumper(prefix, interval ? 1 : 0);
+    SimulationConfig config;
+    config.num_threads = num_threads;
+    Simulation sim(dumper, config);
+
+    std::unique_ptr<FrameCapture> capture;
+    if (argc > 5 && strcmp(argv[5], "-") != 0) {
+        capture.reset(new FrameCapture(argv[5], dumper.width(), dumper.height()));
+        sim.set_capture(capture.get());
+    }
+    //the trace keeps only the last ticks
+    if (argc > 6 && strcmp(argv[6], "-") != 0)
+        sim.set_tracing(true);
+    bool count = argc > 7 && atoi(argv[7]);
+    sim.set_perf_counting(count);
+    //the costs of the last ChunkCosts::WINDOW ticks
+    const char *costs = argc > 8 && strcmp(argv[8], "-") != 0 ? argv[8] : nullptr;
+    sim.set_cost_tracking(costs != nullptr);
+
+    sim.spawn_cloud(200, 100, 60, ParticleType::Sand);
+    sim.spawn_cloud(500, 120, 80, ParticleType::Water);
+    sim.spawn_cloud(800, 400, 60, ParticleType::Wood);
+    sim.spawn_cloud(800, 340, 4, ParticleType::Fire);
+
+    using Clock = std::chrono::steady_clock;
+    double update_secs = 0.0, render_secs = 0.0;
+    long long updated = 0, tested = 0;
+    for (int i = 0; i < ticks; ++i) {
+        auto t0 = Clock::now();
+        sim.update();
+        auto t1 = Clock::now();
+        update_secs += std::chrono::duration<double>(t1 - t0).count();
+        updated += sim.num_updated_particles();
+        tested += sim.num_tested_particles();
+
+        //the redraw rects accumulate, so frames that won't be dumped can be skipped
+        if (interval && i % interval == 0) {
+            sim.render();
+            render_secs += std::chrono::duration<double>(Clock::now() - t1).count();
+        }
+    }
+
+    printf("%d ticks: update %.2fms/tick, render %.2fms total\n", ticks,
+            update_secs * 1e3 / std::max(ticks, 1), render_secs * 1e3);
+    printf("updated / tested particles: %lld / %lld, %.2fmil/s\n", updated, tested,
+            update_secs > 0 ? updated / update_secs / 1e6 : 0.0);
+    printf("frames dumped / skipped: %zu / %zu\n", dumper.num_dumped(), dumper.num_skipped());
+    //the same for any number of threads
+    printf("world hash: %016llx\n", static_cast<unsigned long long>(sim.world_hash()));
+    print_latencies(sim);
+    print_memory_usage(sim.memory_usage());
+    if (sim.is_tracing())
+        sim.save_trace(argv[6]);
+    if (count)
+        print_perf(sim, updated, tested);
+    if (costs) {
+        sim.save_cost_csv(std::string(costs) + ".csv");
+        for (int m = 0; m < NUM_CHUNK_METRICS; ++m) {
+            auto metric = static_cast<ChunkMetric>(m);
+            sim.save_cost_heatmap(std::string(costs) + "_" + chunk_metric_name(metric) + ".ppm", metric);
+        }
+    }
+    if (capture) {
+        printf("frames captured / dropped: %zu / %zu\n", 
+                capture->num_captured(), capture->num_dropped());
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+struct Percentiles {
+    float p50, p90, p99, p999, max;
+};
+
+//Log-linear (HDR-style) histogram of non-negative integers, e.g. latencies in microseconds.
+//Exact up to 2 * SUB_BUCKETS, then every power of two is split into SUB_BUCKETS buckets,
+//so the values read back are at most 1 / SUB_BUCKETS (~3%) too high.
+//The memory is fixed; record() is lock-free and can be called from any thread,
+//but the threads recording a lot should get one each, the buckets are shared cache lines.
+//The readouts don't stop the recording, they just might miss the latest values.
+class Histogram {
+public:
+    static const int SUB_BITS = 5;
+    static const uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+    //larger values get clamped
+    static const int MAX_BITS = 36;
+    static const size_t NUM_BUCKETS = (MAX_BITS - SUB_BITS) * SUB_BUCKETS + SUB_BUCKETS;
+
+    Histogram() { reset(); }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t value) {
+        if (value >= (uint64_t(1) << MAX_BITS))
+            value = (uint64_t(1) << MAX_BITS) - 1;
+        m_buckets[bucket_idx(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        uint64_t prev = m_max.load(std::memory_order_relaxed);
+        while (value > prev && !m_max.compare_exchange_weak(prev, value, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    //the smallest value that at least the fraction p (0..1) of the recorded values don't exceed,
+    //rounded up to its bucket; 0 if there's nothing recorded
+    uint64_t percentile(double p) const {
+        uint64_t total = count();
+        if (!total)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(p * total + 0.5);
+        if (rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t upper = bucket_upper(i), top = max();
+                return upper < top ? upper : top;
+            }
+        }
+        return max();
+    }
+
+    //multiplied by scale, e.g. 1e-3f for microseconds into milliseconds
+    Percentiles percentiles(float scale = 1.f) const {
+        return Percentiles{
+            percentile(0.5) * scale, percentile(0.9) * scale, percentile(0.99) * scale,
+            percentile(0.999) * scale, max() * scale
+        };
+    }
+
+    //not atomic as a whole, the values recorded meanwhile might survive in part
+    void reset() {
+        for (auto &b: m_buckets)
+            b.store(0, std::memory_order_relaxed);
+        m_count.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> m_count, m_max;
+
+    static int msb(uint64_t x) {
+        int n = 0;
+        while (x >>= 1)
+            ++n;
+        return n;
+    }
+
+    static size_t bucket_idx(uint64_t value) {
+        if (value < 2 * SUB_BUCKETS)
+            return static_cast<size_t>(value);
+        //the top SUB_BITS + 1 bits, the highest one is always set
+        int shift = msb(value) - SUB_BITS;
+        return static_cast<size_t>(shift * SUB_BUCKETS + (value >> shift));
+    }
+
+    static uint64_t bucket_upper(size_t idx) {
+        if (idx < 2 * SUB_BUCKETS)
+            return idx;
+        int shift = static_cast<int>(idx / SUB_BUCKETS) - 1;
+        uint64_t top = idx % SUB_BUCKETS + SUB_BUCKETS;
+        return ((top + 1) << shift) - 1;
+    }
+};
+
+#endif
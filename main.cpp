@@ -1,23 +1,47 @@
 #include <SFML/Graphics.hpp>
 #include <algorithm>
 #include <cassert>
-#include "simulation.hpp"
+#include <memory>
+#include <filesystem>
+#include <cstdio>
+#include "sim_thread.hpp"
+#include "texture_sink.hpp"
 #include "grid_painter.hpp"
 #include "world.hpp"
 #include "avgtracker.hpp"
+#include "histogram.hpp"
 
 using V2f = sf::Vector2f;
 using V2i = sf::Vector2i;
 
 const int WIDTH = 1024;
 const int HEIGHT = 512;
+const int HUD_REFRESH_FRAMES = 15;
+const sf::Time TIME_STEP = sf::microseconds(FIXED_TIME_STEP.count());
+const char *WORLD_DIR = "world";
+//F5 saves the resident blocks, F9 maps them back
+const char *SNAPSHOT_PATH = "world/snapshot.fss";
+
+static SimulationConfig sim_config() {
+    SimulationConfig config;
+    config.generate_terrain = true;
+    //once a minute
+    config.memory_report_interval = 3600;
+    //the blocks that leave the loaded area are kept here
+    std::error_code ec;
+    std::filesystem::create_directories(WORLD_DIR, ec);
+    if (!ec)
+        config.storage_dir = WORLD_DIR;
+    return config;
+}
 
 class Game {
 public:
     Game(sf::RenderWindow &window)
-        : m_window(window),
+        : m_window(window), m_sim(sim_config()),
           m_view(sf::FloatRect(0.f, 0.f, WIDTH, HEIGHT))
     { 
+        m_prev_center = m_view.getCenter();
         m_window.setView(m_view);
         m_window.setFramerateLimit(60); 
 
@@ -35,51 +59,53 @@ public:
         /* m_text.setOutlineColor(sf::Color::White); */
         /* m_text.setOutlineThickness(1.f); */
         m_text.setCharacterSize(m_view.getSize().x / 48);
+        m_sim.set_overlay(m_draw_grid);
     }
 
+    //the simulation ticks on its own thread at a fixed rate,
+    //this one only feeds it the input and shows whatever frame it has finished last
     void run() {
-        sf::Clock clk, total_clk;
+        sf::Clock total_clk;
         while (m_window.isOpen()) {
             pull_events();
-
-            m_totals.push(total_clk.restart());
-            /* m_delta_acc += delta; */
-            /* while (m_delta_acc > FIXED_TIME_STEP) { */
-
-            clk.restart();
-            update();
-            m_upd_times.push(clk.restart());
-
-                /* m_delta_acc -= FIXED_TIME_STEP; */
-            /* } */
-
+            sf::Time frame_time = total_clk.restart();
+            m_totals.push(frame_time);
+            m_frame_hist.record(frame_time.asMicroseconds());
+            handle_camera_movement();
             render();
-            m_render_times.push(clk.restart());
-
         }
     }
 
 private:
     sf::RenderWindow &m_window;
-    Simulation m_sim;
+    SimThread m_sim;
+    //the frames get uploaded here
+    TextureSink m_sink;
 
     float m_brush_size = 1;
     sf::RectangleShape m_brush;
     ParticleType m_brush_type = ParticleType::None;
+    //where the brush was in the last frame while held down, the stroke connects the two
+    bool m_stroking = false;
+    int m_stroke_x = 0, m_stroke_y = 0;
 
     AvgTracker<sf::Time, 64> m_totals;
-    AvgTracker<sf::Time, 64> m_upd_times;
-    AvgTracker<sf::Time, 64> m_render_times;
-    AvgTracker<int, 64> m_upd_particles;
+    //in microseconds
+    Histogram m_frame_hist;
 
     bool m_draw_grid = true;
     GridPainter m_grid;
+    //what the overlay heat shows: the share of the chunk being updated, or one of the chunk costs
+    int m_heat_metric = -1;
 
     sf::Font m_font;
     sf::Text m_text;
     sf::String m_text_str;
+    int m_hud_frame = 0;
 
     sf::View m_view;
+    V2f m_prev_center;
+    float m_zoom = 0.f;
 
     void pull_events() {
         sf::Event event;
@@ -101,10 +127,38 @@ private:
                     break;
                 case sf::Keyboard::Enter:
                     m_draw_grid = !m_draw_grid;
+                    m_sim.set_overlay(m_draw_grid);
                     break;
                 case sf::Keyboard::Space:
-                    m_sim.update();
-                    m_sim.render();
+                    //an extra tick on top of the regular ones
+                    m_sim.post([](Simulation &sim) { sim.update(); });
+                    break;
+                case sf::Keyboard::R:
+                    m_sim.toggle_capture();
+                    break;
+                case sf::Keyboard::T:
+                    m_sim.toggle_trace();
+                    break;
+                case sf::Keyboard::M:
+                    //the costs only get tracked while shown
+                    m_heat_metric = m_heat_metric + 1 < NUM_CHUNK_METRICS ? m_heat_metric + 1 : -1;
+                    m_sim.set_cost_tracking(m_heat_metric >= 0);
+                    break;
+                case sf::Keyboard::C:
+                    m_sim.save_costs();
+                    break;
+                case sf::Keyboard::H:
+                    m_frame_hist.reset();
+                    m_sim.reset_histograms();
+                    break;
+                case sf::Keyboard::F5:
+                    m_sim.post([](Simulation &sim) {
+                        if (sim.save_snapshot(SNAPSHOT_PATH))
+                            printf("snapshot %s: wrote %zu chunks\n", SNAPSHOT_PATH, sim.snapshot_chunks_written());
+                    });
+                    break;
+                case sf::Keyboard::F9:
+                    m_sim.post([](Simulation &sim) { sim.load_snapshot(SNAPSHOT_PATH); });
                     break;
                 case sf::Keyboard::Num0:
                     m_brush_type = ParticleType::None;
@@ -137,11 +191,19 @@ private:
 
         if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Left)) {
 
-            int x = std::max(0, int(pos.x)) % WIDTH, 
-                y = std::max(0, int(pos.y)) % HEIGHT,
+            //whatever falls outside of the loaded area gets clipped
+            int x = static_cast<int>(pos.x), y = static_cast<int>(pos.y),
                 r = static_cast<int>(m_brush_size);
 
-            m_sim.spawn_cloud(x, y, r, m_brush_type);
+            if (!m_stroking)
+                m_sim.queue_edit(Edit::circle(x, y, r, m_brush_type));
+            else
+                m_sim.queue_edit(Edit::line(m_stroke_x, m_stroke_y, x, y, r, m_brush_type));
+            m_stroking = true;
+            m_stroke_x = x;
+            m_stroke_y = y;
+        } else {
+            m_stroking = false;
         }
     }
 
@@ -161,64 +223,127 @@ private:
             m_view.zoom(0.9f);
         if (Kbd::isKeyPressed(Kbd::Subtract))
             m_view.zoom(1.1f);
-    }
 
-    void update() {
-        handle_camera_movement();
-        m_sim.update();
+        //the simulation streams the world in around the camera and ahead of it;
+        //the velocity is per tick, whatever the frame rate is
+        float ticks_per_frame = m_totals.last() > sf::Time::Zero ? m_totals.last() / TIME_STEP : 1.f;
+        V2f center = m_view.getCenter(),
+            velocity = (center - m_prev_center) / ticks_per_frame;
+        m_prev_center = center;
+        int left = static_cast<int>(center.x - WIDTH / 2), top = static_cast<int>(center.y - HEIGHT / 2);
+        m_sim.post([=](Simulation &sim) { sim.set_camera(left, top, velocity.x, velocity.y); });
+
+        //zoomed out, the texture gets downsampled and stretched back
+        float zoom = m_view.getSize().x / m_window.getSize().x;
+        if (zoom != m_zoom) {
+            m_zoom = zoom;
+            m_sim.post([=](Simulation &sim) { sim.set_zoom(zoom); });
+        }
     }
 
-    void render() {
-        m_window.setView(m_view);
-        m_window.clear();
-
-        m_sim.render();
-        sf::Sprite sp(m_sim.get_texture());
-        m_window.draw(sp);
-
-        m_window.draw(m_brush);
-        if (m_draw_grid)
-            m_window.draw(m_grid);
-
-        sf::RectangleShape rs;
-        rs.setFillColor(sf::Color::Transparent);
-        rs.setOutlineThickness(1.f);
+    void update_overlay(const SimFrame &frame) {
+        const Rect<size_t> &view = frame.view;
+        int offx = static_cast<int>(view.left / Chunk::SIZE), offy = static_cast<int>(view.top / Chunk::SIZE);
+        m_grid.set_origin(static_cast<float>(view.left), static_cast<float>(view.top));
+
+        Rect<int> none;
+        none.reset();
+        //the frame might have been made before the overlay got enabled
+        if (frame.chunks.size() != (WIDTH / Chunk::SIZE) * (HEIGHT / Chunk::SIZE))
+            return;
+        //the costs relative to the most expensive chunk on screen
+        auto metric = static_cast<ChunkMetric>(m_heat_metric);
+        float top = 0.f;
+        if (m_heat_metric >= 0)
+            for (auto &ch: frame.chunks)
+                top = std::max(top, ch.cost[metric]);
         for (int j = 0; j < HEIGHT / Chunk::SIZE; ++j) {
             for (int i = 0; i < WIDTH / Chunk::SIZE; ++i) {
-                auto r = m_sim.chunk_dirty_rect_next(i, j);
-                rs.setSize(V2f(r.width(), r.height()));
-                rs.setPosition(r.left, r.top);
-                rs.setOutlineColor(sf::Color::Red);
-                m_window.draw(rs);
+                int ch_x = offx + i, ch_y = offy + j;
+                const SimFrame::ChunkState &ch = frame.chunks[j * (WIDTH / Chunk::SIZE) + i];
+                if (!ch.loaded) {
+                    m_grid.set_cell(i, j, none, none, none, 0.f);
+                    continue;
+                }
+                float heat;
+                if (m_heat_metric >= 0)
+                    heat = top > 0.f ? ch.cost[metric] / top : 0.f;
+                else
+                    heat = ch.cur.is_empty() ? 0.f 
+                        : float(ch.cur.shared_area(chunk_bounds(ch_x, ch_y))) / (Chunk::SIZE * Chunk::SIZE);
+                m_grid.set_cell(i, j, ch.next, ch.cur, ch.redraw, heat);
             }
         }
+    }
 
-        char buf[512];
-        int n_updated = m_sim.num_updated_particles(), n_tested = m_sim.num_tested_particles();
+    void update_hud(const SimFrame &frame) {
+        char buf[1024];
+        int n_updated = frame.num_updated, n_tested = frame.num_tested;
         float ratio = n_tested ? float(n_updated) / n_tested : 0.f;
-        m_upd_particles.push(n_updated);
-        float avg_particles = m_upd_particles.average() / m_upd_times.average().asSeconds();
         float fps = 1.f / m_totals.average().asSeconds();
+        float ticks_per_sec = 1.f / TIME_STEP.asSeconds();
 
+        Percentiles fr = m_frame_hist.percentiles(1e-3f), up = frame.update_pct, rn = frame.render_pct;
         int n = snprintf(buf, sizeof(buf), "FPS: %6.2f, frame time: %6.2f\n"
                 "Avg update time: %6.2fms, avg render time: %6.2fms\n"
-                "Updated / tested particles this frame: %dk / %dk = %4.2f\n"
-                "Avg updated particles: %6.2fmil/s -- %dk/frame\n"
-                "Thread load distribution:\n",
+                "p50 / p99 / p99.9 / max (H resets):\n"
+                "  frame  %6.2f / %6.2f / %6.2f / %6.2fms\n"
+                "  update %6.2f / %6.2f / %6.2f / %6.2fms\n"
+                "  render %6.2f / %6.2f / %6.2f / %6.2fms\n"
+                "Updated / tested particles this tick: %dk / %dk = %4.2f\n"
+                "Updated particles: %6.2fmil/s, dropped ticks: %llu\n"
+                "Overlay heat (M cycles, C saves): %s\n"
+                "Thread load distribution, busy p99:\n",
                 fps, m_totals.last().asSeconds() * 1000.f,
-                m_upd_times.average().asSeconds() * 1e3f, m_render_times.average().asSeconds() * 1e3f,
+                frame.update_ms, frame.render_ms,
+                fr.p50, fr.p99, fr.p999, fr.max,
+                up.p50, up.p99, up.p999, up.max,
+                rn.p50, rn.p99, rn.p999, rn.max,
                 n_updated / 1000, n_tested / 1000, ratio,
-                avg_particles / 1e6f, static_cast<int>(avg_particles / 1e3f / 60)
+                n_updated * ticks_per_sec / 1e6f, static_cast<unsigned long long>(frame.num_dropped),
+                m_heat_metric >= 0 ? chunk_metric_name(static_cast<ChunkMetric>(m_heat_metric)) : "dirty share"
                 );
 
-        auto &stats = m_sim.get_load_stats();
+        auto &stats = frame.load_balance;
         for (int i = 0; i < stats.size() && n < sizeof(buf); ++i) {
-            n += snprintf(buf + n, sizeof(buf) - n, "%d: %4.2f\n",
-                    i + 1, stats[i].average());
+            float busy = i < frame.busy_pct.size() ? frame.busy_pct[i].p99 : 0.f;
+            n += snprintf(buf + n, sizeof(buf) - n, "%d: %4.2f, %6.2fms\n",
+                    i + 1, stats[i], busy);
         }
 
         m_text_str = buf;
         m_text.setString(m_text_str);
+    }
+
+    void render() {
+        m_window.setView(m_view);
+        m_window.clear();
+
+        bool is_new;
+        const SimFrame &frame = m_sim.acquire(&is_new);
+        if (is_new) {
+            auto size = m_sink.get_texture().getSize();
+            if (static_cast<int>(size.x) != frame.width || static_cast<int>(size.y) != frame.height)
+                m_sink.create(frame.width, frame.height);
+            m_sink.update(frame.pixels.data(), 0, frame.height - 1);
+        }
+
+        sf::Sprite sp(m_sink.get_texture());
+        float scale = static_cast<float>(1 << frame.lod);
+        sp.setScale(scale, scale);
+        sp.setPosition(static_cast<float>(frame.view.left), static_cast<float>(frame.view.top));
+        m_window.draw(sp);
+
+        m_window.draw(m_brush);
+        if (m_draw_grid) {
+            update_overlay(frame);
+            m_window.draw(m_grid);
+        }
+
+        //the numbers are averaged anyway, no need to reformat them every frame
+        if (m_hud_frame++ % HUD_REFRESH_FRAMES == 0)
+            update_hud(frame);
+
         m_text.setPosition(m_window.mapPixelToCoords(V2i(0, 0)));
 
         m_window.draw(m_text);
@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <string>
+#include <cstddef>
+
+//A private (copy-on-write) read-write mapping of a whole file:
+//pages get faulted in on first access, writes never reach the file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string &path);
+    void close();
+    void swap(MappedFile &other);
+
+    bool is_open() const { return m_data != nullptr; }
+    char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    ~MappedFile();
+
+private:
+    char *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void *m_file = nullptr, *m_mapping = nullptr;
+#endif
+};
+
+#endif
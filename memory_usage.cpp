@@ -0,0 +1,49 @@
+#include "memory_usage.hpp"
+#include <algorithm>
+#include <cstdio>
+
+const char* memory_category_name(MemoryCategory category) {
+    switch (category) {
+    case ResidentMemory:
+        return "resident";
+    case SnapshotMemory:
+        return "snapshot";
+    case CacheMemory:
+        return "cache";
+    case StagingMemory:
+        return "staging";
+    case RenderMemory:
+        return "render";
+    case SchedulerMemory:
+        return "scheduler";
+    case SimulationMemory:
+        return "simulation";
+    default:
+        return "?";
+    }
+}
+
+size_t MemoryUsage::total() const {
+    size_t res = 0;
+    for (auto c: current)
+        res += c;
+    return res;
+}
+
+void MemoryUsage::sample(const size_t (&values)[NUM_MEMORY_CATEGORIES]) {
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i) {
+        current[i] = values[i];
+        peak[i] = std::max(peak[i], values[i]);
+    }
+    peak_total = std::max(peak_total, total());
+}
+
+void print_memory_usage(const MemoryUsage &usage) {
+    const double MIB = 1024.0 * 1024.0;
+    printf("memory (MiB)   current      peak\n");
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; ++i) {
+        printf("  %-10s %9.2f %9.2f\n", memory_category_name(static_cast<MemoryCategory>(i)),
+                usage.current[i] / MIB, usage.peak[i] / MIB);
+    }
+    printf("  %-10s %9.2f %9.2f\n", "total", usage.total() / MIB, usage.peak_total / MIB);
+}
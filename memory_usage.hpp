@@ -0,0 +1,41 @@
+#ifndef MEMORY_USAGE_HPP
+#define MEMORY_USAGE_HPP
+
+#include <cstddef>
+
+enum MemoryCategory {
+    //the blocks in the resident slots and the world's own tables
+    ResidentMemory,
+    //the loaded snapshot, mapped copy-on-write; only the touched pages are actually in RAM
+    SnapshotMemory,
+    //the compressed blocks waiting to be spilled to the disk
+    CacheMemory,
+    //the I/O thread's block buffers and its queue
+    StagingMemory,
+    //every level of detail
+    RenderMemory,
+    //the queues, the per-thread statistics and the trace
+    SchedulerMemory,
+    //the per-thread state of the kernels, the phase histograms and the chunk costs
+    SimulationMemory,
+    NUM_MEMORY_CATEGORIES
+};
+
+const char* memory_category_name(MemoryCategory category);
+
+//in bytes; the containers count with their capacity, the heap overhead doesn't count
+struct MemoryUsage {
+    size_t current[NUM_MEMORY_CATEGORIES] = {};
+    //the largest each category has been whenever it got sampled, not necessarily at the same time
+    size_t peak[NUM_MEMORY_CATEGORIES] = {};
+    size_t peak_total = 0;
+
+    size_t total() const;
+    //takes over the current values and raises the peaks
+    void sample(const size_t (&values)[NUM_MEMORY_CATEGORIES]);
+};
+
+//a table of the current and peak values to stdout
+void print_memory_usage(const MemoryUsage &usage);
+
+#endif
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include "simulation.hpp"
+#include "world.hpp"
+#include "region_store.hpp"
+#include "frame_dumper.hpp"
+#include "xorshift.hpp"
+
+//per-primitive timings of the core data structures and kernels:
+//  falling_stuff_microbench [name filter]
+//every benchmark gets warmed up, then timed REPS times;
+//the median and the median absolute deviation of the repetitions are reported per operation
+
+using Clock = std::chrono::steady_clock;
+
+const int REPS = 21;
+//a repetition is calibrated to take at least that long
+const double REP_NANOS = 10e6;
+const double WARMUP_NANOS = 50e6;
+
+//keeps the results alive, so the loops don't get optimised away
+static volatile uint64_t g_sink;
+
+struct Stats {
+    double median, mad;
+};
+
+static double median_of(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+//body(iters) does iters operations and returns how many nanoseconds they took,
+//so the per-operation setup can be left out
+template<typename F>
+static Stats measure(F body) {
+    size_t iters = 1;
+    double elapsed = 0;
+    while ((elapsed = body(iters)) < REP_NANOS && iters < (size_t(1) << 30))
+        iters *= 2;
+    for (double warm = elapsed; warm < WARMUP_NANOS; )
+        warm += body(iters);
+
+    std::vector<double> reps;
+    for (int i = 0; i < REPS; ++i)
+        reps.push_back(body(iters) / iters);
+    double med = median_of(reps);
+    for (auto &r: reps)
+        r = std::abs(r - med);
+    return Stats{ med, median_of(reps) };
+}
+
+template<typename F>
+static double time_loop(size_t iters, F f) {
+    auto t = Clock::now();
+    for (size_t i = 0; i < iters; ++i)
+        f(i);
+    return std::chrono::duration<double, std::nano>(Clock::now() - t).count();
+}
+
+static const char *g_filter = nullptr;
+
+//ops: how many of the reported units one operation covers
+template<typename F>
+static void run(const char *name, const char *unit, double ops, F body) {
+    if (g_filter && !strstr(name, g_filter))
+        return;
+    Stats s = measure(body);
+    printf("%-28s %10.3f ns/%-8s MAD %8.3f (%4.1f%%)\n", name, s.median / ops, unit,
+            s.mad / ops, s.median > 0 ? 100.0 * s.mad / s.median : 0.0);
+    fflush(stdout);
+}
+
+//reaches into the simulation for the kernels and the scheduler
+struct MicroBench {
+    static World& world(Simulation &sim) { return *sim.m_world; }
+    static UpdateScheduler& scheduler(Simulation &sim) { return sim.m_scheduler; }
+
+    static void update_chunk(Simulation &sim, size_t ch_x, size_t ch_y) {
+        sim.update_chunk(ch_x, ch_y, sim.m_world->get_chunk(ch_x, ch_y), 0);
+    }
+
+    static void render_chunk(Simulation &sim, size_t ch_x, size_t ch_y) {
+        sim.render_chunk(ch_x, ch_y, sim.m_world->get_chunk(ch_x, ch_y), 0);
+    }
+};
+
+const size_t NUM_SAMPLES = 4096;
+const size_t CELLS = Chunk::SIZE * Chunk::SIZE;
+
+static void bench_lookups() {
+    World world;
+    XorShift gen;
+    std::vector<std::pair<size_t, size_t>> coords(NUM_SAMPLES);
+    for (auto &c: coords)
+        c = { gen() % (2 * Block::SIZE), gen() % Block::SIZE };
+
+    run("world_get", "lookup", 1, [&](size_t iters) {
+        uint64_t acc = 0;
+        double ns = time_loop(iters, [&](size_t i) {
+            auto &c = coords[i % NUM_SAMPLES];
+            acc += static_cast<uint64_t>(world.get(c.first, c.second).type());
+        });
+        g_sink = acc;
+        return ns;
+    });
+    run("world_get_chunk", "lookup", 1, [&](size_t iters) {
+        uint64_t acc = 0;
+        double ns = time_loop(iters, [&](size_t i) {
+            auto &c = coords[i % NUM_SAMPLES];
+            acc += world.get_chunk(c.first / Chunk::SIZE, c.second / Chunk::SIZE).is_uniform;
+        });
+        g_sink = acc;
+        return ns;
+    });
+
+    Chunk &ch = world.get_chunk(1, 1);
+    run("chunk_get", "lookup", 1, [&](size_t iters) {
+        uint64_t acc = 0;
+        double ns = time_loop(iters, [&](size_t i) {
+            acc += static_cast<uint64_t>(ch.get(i % Chunk::SIZE, i / Chunk::SIZE % Chunk::SIZE).type());
+        });
+        g_sink = acc;
+        return ns;
+    });
+}
+
+static void bench_rects() {
+    XorShift gen;
+    //every pair shares the point (500, 500), so they all intersect
+    std::vector<Rect<int>> rects(NUM_SAMPLES);
+    for (auto &r: rects) {
+        r = Rect<int>(500 - static_cast<int>(gen() % 500), 500 - static_cast<int>(gen() % 500),
+                500 + static_cast<int>(gen() % 500), 500 + static_cast<int>(gen() % 500));
+    }
+
+    run("rect_include_rect", "op", 1, [&](size_t iters) {
+        Rect<int> acc;
+        acc.reset();
+        double ns = time_loop(iters, [&](size_t i) { acc.include(rects[i % NUM_SAMPLES]); });
+        g_sink = acc.width();
+        return ns;
+    });
+    run("rect_include_point", "op", 1, [&](size_t iters) {
+        Rect<int> acc;
+        acc.reset();
+        double ns = time_loop(iters, [&](size_t i) {
+            auto &r = rects[i % NUM_SAMPLES];
+            acc.include<false>(r.left, r.bottom);
+        });
+        g_sink = acc.width();
+        return ns;
+    });
+    run("rect_intersection", "op", 1, [&](size_t iters) {
+        int acc = 0;
+        double ns = time_loop(iters, [&](size_t i) {
+            acc += rects[i % NUM_SAMPLES].intersection(rects[(i + 1) % NUM_SAMPLES]).width();
+        });
+        g_sink = acc;
+        return ns;
+    });
+}
+
+static void bench_xorshift() {
+    XorShift gen;
+    run("xorshift", "number", 1, [&](size_t iters) {
+        uint64_t acc = 0;
+        double ns = time_loop(iters, [&](size_t) { acc ^= gen(); });
+        g_sink = acc;
+        return ns;
+    });
+    std::uniform_int_distribution<int> dist(1, 4);
+    run("xorshift_uniform_int", "number", 1, [&](size_t iters) {
+        uint64_t acc = 0;
+        double ns = time_loop(iters, [&](size_t) { acc += dist(gen); });
+        g_sink = acc;
+        return ns;
+    });
+}
+
+static void bench_fit_block() {
+    World world;
+    Block &blk = world.get_block(0, 0);
+    run("fit_block_idle", "block", 1, [&](size_t iters) {
+        return time_loop(iters, [&](size_t) { world.fit_block(0, 0); });
+    });
+
+    //a small next rect in the middle of every chunk, and one spilling over the border
+    for (size_t j = 0; j < Block::N; ++j) {
+        for (size_t i = 0; i < Block::N; ++i) {
+            Rect<int> b = chunk_bounds(i, j);
+            blk.chunks[j][i].next_dirty_rect = Rect<int>(b.left + 20, b.top + 20, b.left + 40, b.top + 40);
+        }
+    }
+    Rect<int> &spill = blk.chunks[3][3].next_dirty_rect;
+    spill = Rect<int>(spill.left - 30, spill.top - 30, spill.right + 30, spill.bottom + 30);
+    run("fit_block_busy", "block", 1, [&](size_t iters) {
+        return time_loop(iters, [&](size_t) { world.fit_block(0, 0); });
+    });
+}
+
+//the chunk in the middle of the initial view and its neighbours
+const size_t KERNEL_CH_X = 5, KERNEL_CH_Y = 4;
+
+template<typename P>
+static void fill_chunk(World &world, P pattern) {
+    for (size_t ch_y = KERNEL_CH_Y - 1; ch_y <= KERNEL_CH_Y + 1; ++ch_y) {
+        for (size_t ch_x = KERNEL_CH_X - 1; ch_x <= KERNEL_CH_X + 1; ++ch_x) {
+            Chunk &ch = world.get_chunk(ch_x, ch_y);
+            bool centre = ch_x == KERNEL_CH_X && ch_y == KERNEL_CH_Y;
+            for (size_t y = 0; y < Chunk::SIZE; ++y)
+                for (size_t x = 0; x < Chunk::SIZE; ++x)
+                    ch.data[y][x] = centre ? pattern(x, y) : Particle();
+            ch.is_uniform = false;
+            ch.cur_dirty_rect.reset();
+            ch.next_dirty_rect.reset();
+            if (centre)
+                ch.cur_dirty_rect = chunk_bounds(ch_x, ch_y);
+        }
+    }
+}
+
+//the kernels move the particles around, so every update starts from a copy of the same chunks
+template<typename P>
+static void bench_kernel(const char *name, Simulation &sim, P pattern) {
+    World &world = MicroBench::world(sim);
+    fill_chunk(world, pattern);
+    std::vector<Chunk> saved;
+    for (size_t ch_y = KERNEL_CH_Y - 1; ch_y <= KERNEL_CH_Y + 1; ++ch_y)
+        for (size_t ch_x = KERNEL_CH_X - 1; ch_x <= KERNEL_CH_X + 1; ++ch_x)
+            saved.push_back(world.get_chunk(ch_x, ch_y));
+
+    run(name, "cell", CELLS, [&](size_t iters) {
+        double ns = 0;
+        for (size_t i = 0; i < iters; ++i) {
+            size_t k = 0;
+            for (size_t ch_y = KERNEL_CH_Y - 1; ch_y <= KERNEL_CH_Y + 1; ++ch_y)
+                for (size_t ch_x = KERNEL_CH_X - 1; ch_x <= KERNEL_CH_X + 1; ++ch_x)
+                    world.get_chunk(ch_x, ch_y) = saved[k++];
+            auto t = Clock::now();
+            MicroBench::update_chunk(sim, KERNEL_CH_X, KERNEL_CH_Y);
+            ns += std::chrono::duration<double, std::nano>(Clock::now() - t).count();
+        }
+        return ns;
+    });
+}
+
+static void bench_kernels() {
+    FrameDumper dumper("", 0);
+    SimulationConfig config;
+    config.num_threads = 0;
+    Simulation sim(dumper, config);
+
+    //the upper half filled, everything falls
+    bench_kernel("update_sand", sim, [](size_t, size_t y) {
+        return y < Chunk::SIZE / 2 ? Particle::create<Sand>() : Particle();
+    });
+    bench_kernel("update_water", sim, [](size_t, size_t y) {
+        return y < Chunk::SIZE / 2 ? Particle::create<Water>() : Particle();
+    });
+    //every fourth cell burning in a wood block
+    bench_kernel("update_fire", sim, [](size_t x, size_t y) {
+        return (x + y) % 4 ? Particle::create<Wood>() : Particle::create<Fire>();
+    });
+    //nothing to do, only the dispatch on the type
+    bench_kernel("update_wood", sim, [](size_t, size_t) {
+        return Particle::create<Wood>();
+    });
+    bench_kernel("update_empty", sim, [](size_t, size_t) {
+        return Particle();
+    });
+
+    World &world = MicroBench::world(sim);
+    Chunk &ch = world.get_chunk(KERNEL_CH_X, KERNEL_CH_Y);
+    auto render = [&](size_t iters) {
+        double ns = 0;
+        for (size_t i = 0; i < iters; ++i) {
+            ch.needs_redrawing[0] = chunk_bounds(KERNEL_CH_X, KERNEL_CH_Y);
+            auto t = Clock::now();
+            MicroBench::render_chunk(sim, KERNEL_CH_X, KERNEL_CH_Y);
+            ns += std::chrono::duration<double, std::nano>(Clock::now() - t).count();
+        }
+        return ns;
+    };
+    //stripes of every type
+    fill_chunk(world, [](size_t, size_t y) {
+        switch (y / 4 % 5) {
+        case 0: return Particle::create<Sand>();
+        case 1: return Particle::create<Water>();
+        case 2: return Particle::create<Wood>();
+        case 3: return Particle::create<Fire>();
+        default: return Particle();
+        }
+    });
+    run("render_chunk", "pixel", CELLS, render);
+    fill_chunk(world, [](size_t, size_t) { return Particle::create<Sand>(); });
+    ch.detect_uniform();
+    run("render_chunk_uniform", "pixel", CELLS, render);
+}
+
+//chunks with nothing to do, so only the queueing and the hand-off to the workers is left
+static void bench_dispatch(size_t num_threads) {
+    FrameDumper dumper("", 0);
+    SimulationConfig config;
+    config.num_threads = num_threads;
+    Simulation sim(dumper, config);
+    World &world = MicroBench::world(sim);
+    UpdateScheduler &sched = MicroBench::scheduler(sim);
+
+    const size_t N = 2 * Block::N * Block::N;
+    char name[64];
+    snprintf(name, sizeof(name), "dispatch_%zu_workers", num_threads);
+    run(name, "chunk", N, [&](size_t iters) {
+        return time_loop(iters, [&](size_t) {
+            sched.clear();
+            for (size_t ch_y = 0; ch_y < Block::N; ++ch_y)
+                for (size_t ch_x = 0; ch_x < 2 * Block::N; ++ch_x)
+                    sched.push_chunk(ch_x, ch_y, &world.get_chunk(ch_x, ch_y));
+            sched.run(scheduler::Prepare);
+        });
+    });
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1)
+        g_filter = argv[1];
+
+    bench_lookups();
+    bench_rects();
+    bench_xorshift();
+    bench_fit_block();
+    bench_kernels();
+    bench_dispatch(0);
+    bench_dispatch(3);
+}
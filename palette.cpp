@@ -0,0 +1,87 @@
+#include "palette.hpp"
+#include <cstdint>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define PALETTE_SSSE3
+#endif
+
+const size_t NUM_FIRE_FLICKERS = 5;
+const uint16_t FLICKER_DURATION = 100; //in millis
+const Color FIRE_FLICKER_COLORS[NUM_FIRE_FLICKERS] = {
+    //  R,   G,   B,   A
+    { 255, 255,   0, 255 },
+    { 255, 200,   0, 255 },
+    { 255, 150,   0, 255 },
+    { 255, 100,   0, 255 },
+    { 255,  50,   0, 255 },
+};
+
+//every type but fire has a single colour; exactly 16 bytes, which is one pshufb table
+const size_t NUM_SOLID_TYPES = 4;
+const Color SOLID_COLORS[NUM_SOLID_TYPES] = {
+    Color(0, 0, 0),         //None
+    Color(255, 255, 0),     //Sand
+    Color(0, 0, 255),       //Water
+    Color(80, 0, 0),        //Wood
+};
+
+static_assert(size_t(ParticleType::Fire) == NUM_SOLID_TYPES, "fire must follow the solid types");
+static_assert(sizeof(Particle) == 4 && sizeof(Color) == 4, "the row kernel relies on 4-byte cells");
+
+//flicker colour for every lifetime, with the division and the modulo baked in
+struct FlickerTable {
+    static const size_t SIZE = UINT16_MAX / FLICKER_DURATION + 1;
+    Color colors[SIZE];
+
+    FlickerTable() {
+        for (size_t i = 0; i < SIZE; ++i)
+            colors[i] = FIRE_FLICKER_COLORS[i % NUM_FIRE_FLICKERS];
+    }
+
+    const Color& operator[](uint16_t lifetime) const {
+        return colors[lifetime / FLICKER_DURATION];
+    }
+};
+
+const FlickerTable FIRE_FLICKER;
+
+Color particle_color(const Particle &p) {
+    if (p.is<Fire>())
+        return FIRE_FLICKER[p.as.fire.lifetime];
+    size_t tp = static_cast<size_t>(p.type());
+    return tp < NUM_SOLID_TYPES ? SOLID_COLORS[tp] : Color::Black;
+}
+
+void redraw_row(const Particle *src, size_t n, Color *dst) {
+    size_t i = 0;
+#ifdef PALETTE_SSSE3
+    //the type sits in the low 7 bits of the first byte of each 4-byte particle:
+    //turn it into byte offsets 4t..4t+3 into the colour table and shuffle the table by them
+    const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i*>(SOLID_COLORS));
+    const __m128i type_mask = _mm_set1_epi32(0x7F);
+    const __m128i broadcast = _mm_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+    const __m128i components = _mm_set1_epi32(0x03020100);
+    const __m128i fire = _mm_set1_epi32(static_cast<int>(Fire::TYPE));
+    for (; i + 4 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i tp = _mm_and_si128(p, type_mask);
+        __m128i idx = _mm_add_epi8(_mm_shuffle_epi8(_mm_slli_epi32(tp, 2), broadcast), components);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(lut, idx));
+
+        int has_fire = _mm_movemask_epi8(_mm_cmpeq_epi32(tp, fire));
+        if (has_fire) {
+            for (size_t j = 0; j < 4; ++j)
+                if (has_fire & (1 << (4 * j)))
+                    dst[i + j] = FIRE_FLICKER[src[i + j].as.fire.lifetime];
+        }
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = particle_color(src[i]);
+}
+
+void redraw_row(const Particle *src, size_t step, size_t n, Color *dst) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = particle_color(src[i * step]);
+}
@@ -0,0 +1,16 @@
+#ifndef PALETTE_HPP
+#define PALETTE_HPP
+
+#include <cstddef>
+#include "color.hpp"
+#include "particle.hpp"
+
+Color particle_color(const Particle &p);
+
+//colours n consecutive particles into n consecutive pixels
+void redraw_row(const Particle *src, size_t n, Color *dst);
+
+//same, but takes every step-th particle (used by the coarse levels of detail)
+void redraw_row(const Particle *src, size_t step, size_t n, Color *dst);
+
+#endif
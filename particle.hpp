@@ -45,9 +45,12 @@ class Particle {
     //Ready to pack some other general properties here
     uint8_t padding;
 
+    //the unused bytes are zeroed, so equal particles are equal bit for bit
     Particle(ParticleType tp, bool been_updated = false) 
-        : m_data(uint8_t(tp) | uint8_t(been_updated) << 7)
-    {}
+        : m_data(uint8_t(tp) | uint8_t(been_updated) << 7), padding(0)
+    {
+        as.sand.vy = 0;
+    }
 public:
     Particle()
         : Particle(None::TYPE) {}
@@ -0,0 +1,112 @@
+#include "perf_counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+const char* perf_counter_name(PerfCounter counter) {
+    switch (counter) {
+    case Cycles:
+        return "cycles";
+    case Instructions:
+        return "instructions";
+    case L1DMisses:
+        return "l1d_misses";
+    case LLCMisses:
+        return "llc_misses";
+    case BranchMisses:
+        return "branch_misses";
+    default:
+        return "?";
+    }
+}
+
+#ifdef __linux__
+
+static int open_counter(PerfCounter counter, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (counter) {
+    case Cycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case Instructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case L1DMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case LLCMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case BranchMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    default:
+        return -1;
+    }
+    //the members follow the leader, which starts once the whole group is open
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    //this thread, any cpu
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+PerfCounters::PerfCounters() : m_num_open(0), m_mask(0) {
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        auto counter = static_cast<PerfCounter>(i);
+        int fd = open_counter(counter, m_num_open ? m_fds[0] : -1);
+        if (fd < 0)
+            continue;
+        m_fds[m_num_open] = fd;
+        m_order[m_num_open++] = counter;
+        m_mask |= 1u << counter;
+    }
+    if (m_num_open)
+        ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounters::~PerfCounters() {
+    for (int i = 0; i < m_num_open; ++i)
+        close(m_fds[i]);
+}
+
+PerfSample PerfCounters::read() const {
+    PerfSample res;
+    if (!m_num_open)
+        return res;
+    //nr followed by the values in the order of opening
+    uint64_t buf[1 + NUM_PERF_COUNTERS];
+    ssize_t len = ::read(m_fds[0], buf, sizeof(buf));
+    if (len < static_cast<ssize_t>(sizeof(uint64_t)))
+        return res;
+    for (uint64_t i = 0; i < buf[0] && static_cast<int>(i) < m_num_open; ++i)
+        res.values[m_order[i]] = buf[1 + i];
+    res.mask = m_mask;
+    return res;
+}
+
+#else
+
+PerfCounters::PerfCounters() : m_num_open(0), m_mask(0) {}
+
+PerfCounters::~PerfCounters() = default;
+
+PerfSample PerfCounters::read() const {
+    return PerfSample();
+}
+
+#endif
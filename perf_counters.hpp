@@ -0,0 +1,64 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <cstdint>
+
+enum PerfCounter {
+    Cycles,
+    Instructions,
+    L1DMisses,
+    LLCMisses,
+    BranchMisses,
+    NUM_PERF_COUNTERS
+};
+
+const char* perf_counter_name(PerfCounter counter);
+
+struct PerfSample {
+    uint64_t values[NUM_PERF_COUNTERS] = {};
+    //a bit for each counter that actually got measured
+    uint32_t mask = 0;
+
+    bool has(PerfCounter counter) const { return mask & (1u << counter); }
+
+    PerfSample& operator+=(const PerfSample &other) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; ++i)
+            values[i] += other.values[i];
+        mask |= other.mask;
+        return *this;
+    }
+};
+
+inline PerfSample operator-(const PerfSample &lhs, const PerfSample &rhs) {
+    PerfSample res;
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i)
+        res.values[i] = lhs.values[i] - rhs.values[i];
+    res.mask = lhs.mask & rhs.mask;
+    return res;
+}
+
+//Hardware counters of the calling thread (user space only), read all at once as a perf_event group.
+//Linux only; elsewhere, or without the permissions (see /proc/sys/kernel/perf_event_paranoid),
+//nothing gets opened and the samples come out empty.
+//The counters the CPU (or the VM) doesn't have are left out of the mask.
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool is_available() const { return m_mask != 0; }
+    //the running totals
+    PerfSample read() const;
+
+private:
+    int m_fds[NUM_PERF_COUNTERS];
+    //which counter each value read from the group belongs to, in the order they were opened
+    PerfCounter m_order[NUM_PERF_COUNTERS];
+    int m_num_open;
+    uint32_t m_mask;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef PIXEL_SINK_HPP
+#define PIXEL_SINK_HPP
+
+#include "color.hpp"
+
+//the destination of the pixels produced by RenderBuffer;
+//the simulation itself knows nothing about textures or windows
+class PixelSink {
+public:
+    virtual ~PixelSink() = default;
+
+    //(re)allocates the storage for a width x height image
+    virtual void create(int width, int height) = 0;
+
+    //receives rows [y, yy] of the tightly packed image,
+    //pixels points to the first pixel of row y
+    virtual void update(const Color *pixels, int y, int yy) = 0;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include "region_store.hpp"
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include "world.hpp"
+
+static_assert(std::is_trivially_copyable<Block>::value, "blocks are stored verbatim");
+
+const char REGION_MAGIC[4] = { 'F', 'S', 'R', 'G' };
+const uint32_t REGION_VERSION = 1;
+
+bool seek_file(FILE *file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+RegionStore::RegionStore(std::string dir)
+    : m_dir(std::move(dir)), m_clock(0) {}
+
+bool RegionStore::has_block(size_t blk_x, size_t blk_y) {
+    Region *reg = get_region(blk_x, blk_y);
+    return reg && reg->index[entry_idx(blk_x, blk_y)].size;
+}
+
+bool RegionStore::write_block(size_t blk_x, size_t blk_y, const Block &blk) {
+    Region *reg = get_region(blk_x, blk_y);
+    if (!reg)
+        return false;
+
+    size_t idx = entry_idx(blk_x, blk_y);
+    IndexEntry &e = reg->index[idx];
+    const uint32_t size = sizeof(Block);
+    if (e.capacity < size) {
+        e.offset = reg->end;
+        e.capacity = size;
+        reg->end += size;
+    }
+    e.size = size;
+
+    //data first, so a crash in between leaves the old index pointing at valid space
+    if (!seek_file(reg->file, e.offset) || fwrite(&blk, size, 1, reg->file) != 1)
+        return false;
+    if (!seek_file(reg->file, entry_offset(idx)) || fwrite(&e, sizeof(e), 1, reg->file) != 1)
+        return false;
+    return fflush(reg->file) == 0;
+}
+
+bool RegionStore::read_block(size_t blk_x, size_t blk_y, Block &blk) {
+    Region *reg = get_region(blk_x, blk_y);
+    if (!reg)
+        return false;
+
+    const IndexEntry &e = reg->index[entry_idx(blk_x, blk_y)];
+    if (e.size != sizeof(Block))
+        return false;
+    return seek_file(reg->file, e.offset) && fread(&blk, sizeof(Block), 1, reg->file) == 1;
+}
+
+RegionStore::~RegionStore() {
+    for (auto &i: m_regions)
+        fclose(i.second->file);
+}
+
+RegionStore::Region* RegionStore::get_region(size_t blk_x, size_t blk_y) {
+    size_t reg_x = blk_x / REGION_SIZE, reg_y = blk_y / REGION_SIZE;
+    auto it = m_regions.find({ reg_x, reg_y });
+    Region *reg = it != m_regions.end() ? it->second.get() : open_region(reg_x, reg_y);
+    if (reg)
+        reg->last_used = ++m_clock;
+    return reg;
+}
+
+RegionStore::Region* RegionStore::open_region(size_t reg_x, size_t reg_y) {
+    if (m_regions.size() >= MAX_OPEN_REGIONS)
+        close_lru();
+
+    char path[64];
+    snprintf(path, sizeof(path), "/r.%zu.%zu.fsr", reg_x, reg_y);
+    std::string full_path = m_dir + path;
+
+    std::unique_ptr<Region> reg(new Region());
+    reg->file = fopen(full_path.c_str(), "r+b");
+    bool created = !reg->file;
+    if (created)
+        reg->file = fopen(full_path.c_str(), "w+b");
+    if (!reg->file) {
+        printf("FAILED TO OPEN %s\n", full_path.c_str());
+        return nullptr;
+    }
+    //the records are large and go straight from / to the blocks
+    setvbuf(reg->file, nullptr, _IONBF, 0);
+
+    Header h;
+    if (created) {
+        memcpy(h.magic, REGION_MAGIC, sizeof(h.magic));
+        h.version = REGION_VERSION;
+        h.record_size = sizeof(Block);
+        h.region_size = REGION_SIZE;
+        memset(reg->index, 0, sizeof(reg->index));
+        if (fwrite(&h, sizeof(h), 1, reg->file) != 1
+                || fwrite(reg->index, sizeof(reg->index), 1, reg->file) != 1) {
+            fclose(reg->file);
+            return nullptr;
+        }
+    } else {
+        bool ok = fread(&h, sizeof(h), 1, reg->file) == 1
+            && fread(reg->index, sizeof(reg->index), 1, reg->file) == 1
+            && !memcmp(h.magic, REGION_MAGIC, sizeof(h.magic))
+            && h.version == REGION_VERSION
+            && h.record_size == sizeof(Block)
+            && h.region_size == REGION_SIZE;
+        if (!ok) {
+            printf("INCOMPATIBLE REGION FILE %s\n", full_path.c_str());
+            fclose(reg->file);
+            return nullptr;
+        }
+    }
+
+    reg->end = entry_offset(NUM_ENTRIES);
+    for (auto &e: reg->index)
+        reg->end = std::max(reg->end, e.offset + e.capacity);
+
+    Region *result = reg.get();
+    m_regions[{ reg_x, reg_y }] = std::move(reg);
+    return result;
+}
+
+void RegionStore::close_lru() {
+    auto lru = std::min_element(m_regions.begin(), m_regions.end(),
+        [](auto &lhs, auto &rhs) { return lhs.second->last_used < rhs.second->last_used; });
+    fclose(lru->second->file);
+    m_regions.erase(lru);
+}
+
+size_t RegionStore::entry_idx(size_t blk_x, size_t blk_y) {
+    return (blk_y % REGION_SIZE) * REGION_SIZE + blk_x % REGION_SIZE;
+}
+
+uint64_t RegionStore::entry_offset(size_t idx) {
+    return sizeof(Header) + idx * sizeof(IndexEntry);
+}
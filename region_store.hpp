@@ -0,0 +1,74 @@
+#ifndef REGION_STORE_HPP
+#define REGION_STORE_HPP
+
+#include <string>
+#include <map>
+#include <memory>
+#include <utility>
+#include <cstdio>
+#include <cstdint>
+
+struct Block;
+
+//SEEK_SET with 64-bit offsets, which fseek() can't do where long is 32 bits (Windows)
+bool seek_file(FILE *file, uint64_t offset);
+
+//Persistent storage for blocks that leave the resident window.
+//The world is split into regions of REGION_SIZE x REGION_SIZE blocks,
+//each region lives in its own file <dir>/r.<x>.<y>.fsr:
+//  header | index of REGION_SIZE^2 entries | block records
+//A record is the block's memory as is, so it's written from and read into
+//the block slot directly, without any intermediate buffers.
+//A rewritten block reuses its old record; a missing block has a zero-sized entry.
+class RegionStore {
+public:
+    static const size_t REGION_SIZE = 8;
+
+    //the directory must exist
+    explicit RegionStore(std::string dir);
+
+    bool has_block(size_t blk_x, size_t blk_y);
+    bool write_block(size_t blk_x, size_t blk_y, const Block &blk);
+    //leaves the block untouched and returns false if it was never written
+    bool read_block(size_t blk_x, size_t blk_y, Block &blk);
+
+    ~RegionStore();
+
+private:
+    static const size_t MAX_OPEN_REGIONS = 16;
+    static const size_t NUM_ENTRIES = REGION_SIZE * REGION_SIZE;
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t capacity;
+    };
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t record_size;
+        uint32_t region_size;
+    };
+
+    struct Region {
+        FILE *file;
+        uint64_t end;
+        uint64_t last_used;
+        IndexEntry index[NUM_ENTRIES];
+    };
+
+    std::string m_dir;
+    std::map<std::pair<size_t, size_t>, std::unique_ptr<Region>> m_regions;
+    uint64_t m_clock;
+
+    //opens or creates the region file, nullptr on failure
+    Region* get_region(size_t blk_x, size_t blk_y);
+    Region* open_region(size_t reg_x, size_t reg_y);
+    void close_lru();
+
+    static size_t entry_idx(size_t blk_x, size_t blk_y);
+    static uint64_t entry_offset(size_t idx);
+};
+
+#endif
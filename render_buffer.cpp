@@ -2,42 +2,51 @@
 #include <cassert>
 #include <algorithm>
 
-RenderBuffer::RenderBuffer(int width, int height) {
-    if (!m_texture.create(width, height)) {
-        printf("FAILED TO CREATE TEXTURE\n");
-    }
-    m_pixels.resize(width * height);
-    std::fill(m_pixels.begin(), m_pixels.end(), sf::Color::Black);
+RenderBuffer::RenderBuffer(int width, int height, PixelSink &sink) 
+    : m_sink(sink), m_width(width), m_height(height), m_lod(0)
+{
+    m_sink.create(width, height);
+    for (int i = 0; i < NUM_LODS; ++i)
+        m_levels[i].resize((width >> i) * (height >> i), Color::Black);
 }
 
-size_t RenderBuffer::xy2idx(int x, int y) const {
-    return y * m_texture.getSize().x + x;
+size_t RenderBuffer::memory_bytes() const {
+    size_t res = 0;
+    for (auto &level: m_levels)
+        res += level.capacity() * sizeof(Color);
+    return res;
 }
 
-void RenderBuffer::clear(const sf::Color &color) {
-    std::fill(m_pixels.begin(), m_pixels.end(), color);
+size_t RenderBuffer::xy2idx(int x, int y) const {
+    return y * width() + x;
 }
 
-sf::Color& RenderBuffer::pixel(int x, int y) {
-    return m_pixels[xy2idx(x, y)];
+void RenderBuffer::clear(const Color &color) {
+    for (auto &level: m_levels)
+        std::fill(level.begin(), level.end(), color);
 }
 
-const sf::Color& RenderBuffer::pixel(int x, int y) const {
-    return m_pixels[xy2idx(x, y)];
+Color& RenderBuffer::pixel(int x, int y) {
+    return m_levels[m_lod][xy2idx(x, y)];
 }
 
-void RenderBuffer::flush() {
-    m_texture.update((const sf::Uint8*)m_pixels.data());
+const Color& RenderBuffer::pixel(int x, int y) const {
+    return m_levels[m_lod][xy2idx(x, y)];
 }
 
-void RenderBuffer::flush(int y, int yy) {
-    int width = m_texture.getSize().x;
-    int height = yy - y + 1;
-    m_texture.update((const sf::Uint8*)(&m_pixels[xy2idx(0, y)]),
-        width, height, 0, y);
+void RenderBuffer::set_lod(int lod) {
+    assert(lod >= 0 && lod < NUM_LODS);
+    if (lod == m_lod)
+        return;
+    m_lod = lod;
+    m_sink.create(width(), height());
 }
 
-const sf::Texture& RenderBuffer::get_texture() const {
-    return m_texture;
+void RenderBuffer::flush() {
+    flush(0, height() - 1);
 }
 
+void RenderBuffer::flush(int y, int yy) {
+    assert(y >= 0 && yy < height());
+    m_sink.update(&m_levels[m_lod][xy2idx(0, y)], y, yy);
+}
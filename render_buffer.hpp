@@ -2,24 +2,53 @@
 #define RENDER_BUFFER_HPP
 
 #include <vector>
-#include <SFML/Graphics/Texture.hpp>
+#include <cstddef>
+#include "color.hpp"
+#include "pixel_sink.hpp"
 
-class RenderBuffer : public sf::NonCopyable {
-    sf::Texture m_texture;
-    std::vector<sf::Color> m_pixels;
-
-    size_t xy2idx(int x, int y) const;
+//keeps an image for every level of detail: level n is downsampled 2^n times;
+//only the active level gets drawn to and sent to the sink
+class RenderBuffer {
 public:
-    RenderBuffer(int width, int height);
+    static const int NUM_LODS = 4;
+
+    //the sink must outlive the buffer
+    RenderBuffer(int width, int height, PixelSink &sink);
+    RenderBuffer(const RenderBuffer&) = delete;
+    RenderBuffer& operator=(const RenderBuffer&) = delete;
+
+    //clears every level
+    void clear(const Color &color = Color::White);
+
+    //coordinates are in pixels of the active level
+    Color& pixel(int x, int y);
+    const Color& pixel(int x, int y) const;
+    Color* row(int y) { return &pixel(0, y); }
 
-    void clear(const sf::Color &color = sf::Color::White);
+    //the tightly packed pixels of the active level
+    const Color* data() const { return m_levels[m_lod].data(); }
 
-    sf::Color& pixel(int x, int y);
-    const sf::Color& pixel(int x, int y) const;
+    //recreates the sink storage if the level changes
+    void set_lod(int lod);
+    int lod() const { return m_lod; }
+
+    //dimensions of the active level
+    int width() const { return m_width >> m_lod; }
+    int height() const { return m_height >> m_lod; }
 
     void flush();
     void flush(int y, int yy);
-    const sf::Texture& get_texture() const;
+
+    //every level, in bytes
+    size_t memory_bytes() const;
+
+private:
+    PixelSink &m_sink;
+    std::vector<Color> m_levels[NUM_LODS];
+    int m_width, m_height;
+    int m_lod;
+
+    size_t xy2idx(int x, int y) const;
 };
 
 #endif
@@ -0,0 +1,223 @@
+#include "sim_thread.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include "world.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+const uint8_t NEW_FRAME = 0x80;
+const uint8_t INDEX_MASK = 0x03;
+
+SimThread::SimThread(const SimulationConfig &config)
+    : m_middle(1), m_back(0), m_front(2), m_stop(false), m_overlay(false),
+      m_tick(0), m_dropped(0), m_num_captures(0), m_num_traces(0), m_num_cost_dumps(0), m_width(0), m_height(0)
+{
+    //the render buffer creates the sink storage right away
+    m_sim.reset(new Simulation(*this, config));
+    m_thread = std::thread(&SimThread::routine, this);
+}
+
+SimThread::~SimThread() {
+    m_stop = true;
+    m_thread.join();
+    if (m_capture)
+        m_sim->set_capture(nullptr);
+}
+
+void SimThread::post(Command cmd) {
+    std::lock_guard<std::mutex> lock(m_cmd_mtx);
+    m_commands.push_back(std::move(cmd));
+}
+
+const SimFrame& SimThread::acquire(bool *is_new) {
+    bool fresh = m_middle.load(std::memory_order_relaxed) & NEW_FRAME;
+    if (fresh)
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+    if (is_new)
+        *is_new = fresh;
+    return m_frames[m_front];
+}
+
+void SimThread::toggle_capture() {
+    post([this](Simulation &sim) {
+        if (m_capture) {
+            sim.set_capture(nullptr);
+            printf("captured %zu frames, dropped %zu\n",
+                    m_capture->num_captured(), m_capture->num_dropped());
+            m_capture.reset();
+            return;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "capture_%d.y4m", m_num_captures++);
+        m_capture.reset(new FrameCapture(path, m_width, m_height));
+        sim.set_capture(m_capture.get());
+    });
+}
+
+void SimThread::queue_edit(Edit edit) {
+    m_sim->queue_edit(std::move(edit));
+}
+
+void SimThread::toggle_trace() {
+    post([this](Simulation &sim) {
+        if (!sim.is_tracing()) {
+            sim.set_tracing(true);
+            return;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "trace_%d.json", m_num_traces++);
+        sim.set_tracing(false);
+        if (sim.save_trace(path))
+            printf("trace written to %s\n", path);
+    });
+}
+
+void SimThread::reset_histograms() {
+    post([this](Simulation &sim) {
+        sim.reset_histograms();
+        m_render_hist.reset();
+    });
+}
+
+void SimThread::set_overlay(bool enabled) {
+    m_overlay = enabled;
+}
+
+void SimThread::set_cost_tracking(bool enabled) {
+    post([=](Simulation &sim) { sim.set_cost_tracking(enabled); });
+}
+
+void SimThread::save_costs() {
+    post([this](Simulation &sim) {
+        if (!sim.is_cost_tracking())
+            return;
+        char path[64];
+        int n = m_num_cost_dumps++;
+        snprintf(path, sizeof(path), "costs_%d.csv", n);
+        if (!sim.save_cost_csv(path))
+            return;
+        for (int m = 0; m < NUM_CHUNK_METRICS; ++m) {
+            auto metric = static_cast<ChunkMetric>(m);
+            snprintf(path, sizeof(path), "costs_%d_%s.ppm", n, chunk_metric_name(metric));
+            sim.save_cost_heatmap(path, metric);
+        }
+        printf("chunk costs written to costs_%d.*\n", n);
+    });
+}
+
+void SimThread::routine() {
+    const auto STEP = FIXED_TIME_STEP;
+    auto prev = Clock::now();
+    Clock::duration acc(0);
+
+    while (!m_stop) {
+        auto now = Clock::now();
+        acc += now - prev;
+        prev = now;
+
+        bool changed = run_commands();
+        int n = 0;
+        for (; acc >= STEP && n < MAX_CATCHUP_TICKS; ++n) {
+            auto t0 = Clock::now();
+            m_sim->update();
+            m_update_ms.push(std::chrono::duration<float, std::milli>(Clock::now() - t0).count());
+            acc -= STEP;
+            ++m_tick;
+        }
+        if (acc >= STEP) {
+            m_dropped += acc / STEP;
+            acc %= STEP;
+        }
+
+        if (n || changed) {
+            render();
+            continue;
+        }
+        std::this_thread::sleep_for(STEP - acc);
+    }
+}
+
+bool SimThread::run_commands() {
+    {
+        std::lock_guard<std::mutex> lock(m_cmd_mtx);
+        m_running.swap(m_commands);
+    }
+    bool any = !m_running.empty();
+    for (auto &cmd: m_running)
+        cmd(*m_sim);
+    m_running.clear();
+    return any;
+}
+
+void SimThread::render() {
+    auto t0 = Clock::now();
+    m_sim->render();
+    auto dt = Clock::now() - t0;
+    m_render_ms.push(std::chrono::duration<float, std::milli>(dt).count());
+    m_render_hist.record(std::chrono::duration_cast<std::chrono::microseconds>(dt).count());
+    publish();
+}
+
+void SimThread::publish() {
+    SimFrame &frame = m_frames[m_back];
+    const Rect<size_t> &view = m_sim->view();
+    frame.view = view;
+    frame.lod = m_sim->lod();
+    frame.tick = m_tick;
+    frame.update_ms = m_update_ms.average();
+    frame.render_ms = m_render_ms.average();
+    frame.update_pct = m_sim->phase_histograms().total.percentiles(1e-3f);
+    frame.render_pct = m_render_hist.percentiles(1e-3f);
+    frame.num_updated = m_sim->num_updated_particles();
+    frame.num_tested = m_sim->num_tested_particles();
+    frame.num_dropped = m_dropped;
+
+    auto &stats = m_sim->get_load_stats();
+    frame.load_balance.resize(stats.size());
+    frame.busy_pct.resize(stats.size());
+    for (size_t i = 0; i < stats.size(); ++i) {
+        frame.load_balance[i] = stats[i].average();
+        frame.busy_pct[i] = m_sim->busy_histogram(i).percentiles(1e-3f);
+    }
+
+    frame.chunks.clear();
+    if (m_overlay) {
+        for (size_t ch_y = view.top / Chunk::SIZE; ch_y <= view.bottom / Chunk::SIZE; ++ch_y) {
+            for (size_t ch_x = view.left / Chunk::SIZE; ch_x <= view.right / Chunk::SIZE; ++ch_x) {
+                SimFrame::ChunkState state;
+                state.loaded = m_sim->is_chunk_loaded(ch_x, ch_y);
+                if (state.loaded) {
+                    state.next = m_sim->chunk_dirty_rect_next(ch_x, ch_y);
+                    state.cur = m_sim->chunk_dirty_rect_cur(ch_x, ch_y);
+                    state.redraw = m_sim->chunk_redraw_rect(ch_x, ch_y);
+                    state.cost = m_sim->chunk_cost(ch_x, ch_y);
+                }
+                frame.chunks.push_back(state);
+            }
+        }
+    }
+
+    m_back = m_middle.exchange(m_back | NEW_FRAME, std::memory_order_acq_rel) & INDEX_MASK;
+}
+
+void SimThread::create(int width, int height) {
+    //the other frames get resized once they come around
+    m_width = width;
+    m_height = height;
+}
+
+void SimThread::update(const Color *pixels, int y, int yy) {
+    SimFrame &frame = m_frames[m_back];
+    if (frame.width != m_width || frame.height != m_height) {
+        frame.width = m_width;
+        frame.height = m_height;
+        frame.pixels.assign(static_cast<size_t>(m_width) * m_height, Color::Black);
+    }
+    //every frame gets flushed whole, but not necessarily in one go
+    memcpy(&frame.pixels[static_cast<size_t>(y) * m_width], pixels,
+            sizeof(Color) * static_cast<size_t>(yy - y + 1) * m_width);
+}
@@ -0,0 +1,127 @@
+#ifndef SIM_THREAD_HPP
+#define SIM_THREAD_HPP
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include "simulation.hpp"
+#include "pixel_sink.hpp"
+#include "frame_capture.hpp"
+#include "avgtracker.hpp"
+#include "histogram.hpp"
+#include "rect.hpp"
+
+//whatever the simulation thread hands over to the display: the image and the numbers for the HUD
+struct SimFrame {
+    struct ChunkState {
+        bool loaded;
+        Rect<int> next, cur, redraw;
+        //only with the cost tracking enabled
+        ChunkCost cost;
+    };
+
+    std::vector<Color> pixels;
+    int width = 0, height = 0;
+
+    //what the image covers, in world coordinates, and how much it's downsampled
+    Rect<size_t> view;
+    int lod = 0;
+    uint64_t tick = 0;
+
+    //the chunks on screen row by row, only filled in with the overlay enabled
+    std::vector<ChunkState> chunks;
+
+    //averaged over the last ticks
+    float update_ms = 0.f, render_ms = 0.f;
+    //since the start (or the last reset), in milliseconds
+    Percentiles update_pct = {}, render_pct = {};
+    //the time each thread spent on its chunks per tick
+    std::vector<Percentiles> busy_pct;
+    //of the last tick
+    int num_updated = 0, num_tested = 0;
+    //ticks given up on since the start, because the simulation couldn't keep up
+    uint64_t num_dropped = 0;
+    std::vector<float> load_balance;
+};
+
+//Runs the simulation on its own thread at a fixed rate (FIXED_TIME_STEP),
+//independently of the display.
+//The input gets queued up as commands, which run on the simulation thread before the next tick;
+//the finished frames are handed over through a triple buffer, neither side ever waits for the other.
+class SimThread : private PixelSink {
+public:
+    //more ticks than that in a row and the rest of the backlog gets dropped:
+    //the simulation slows down instead of spiralling
+    static const int MAX_CATCHUP_TICKS = 4;
+
+    using Command = std::function<void(Simulation&)>;
+
+    explicit SimThread(const SimulationConfig &config = SimulationConfig());
+    //finishes the current tick, the queued commands are dropped
+    ~SimThread();
+
+    //callable from any thread
+    void post(Command cmd);
+    //straight into the simulation's queue, see Simulation::queue_edit()
+    void queue_edit(Edit edit);
+
+    //the most recent finished frame, stays untouched until the next call;
+    //only the display thread may call it
+    const SimFrame& acquire(bool *is_new = nullptr);
+
+    //starts recording into capture_<n>.y4m, or stops the recording in progress
+    void toggle_capture();
+    //starts tracing the scheduler, or writes the trace so far into trace_<n>.json and stops
+    void toggle_trace();
+    //starts the latency percentiles over
+    void reset_histograms();
+    //collects the chunk rects for the grid overlay
+    void set_overlay(bool enabled);
+    //tracks what each chunk costs, shown in the overlay
+    void set_cost_tracking(bool enabled);
+    //writes costs_<n>.csv and a costs_<n>_<metric>.ppm heatmap for every metric
+    void save_costs();
+
+private:
+    std::unique_ptr<Simulation> m_sim;
+
+    //[m_back] is being drawn into by the simulation, [m_front] is being displayed,
+    //m_middle is the index of the third one, with NEW_FRAME set if it hasn't been picked up yet
+    SimFrame m_frames[3];
+    std::atomic<uint8_t> m_middle;
+    uint8_t m_back, m_front;
+
+    std::mutex m_cmd_mtx;
+    std::vector<Command> m_commands;
+    //swapped with m_commands, so the commands don't run under the lock
+    std::vector<Command> m_running;
+
+    std::atomic<bool> m_stop, m_overlay;
+    uint64_t m_tick, m_dropped;
+    AvgTracker<float, 64> m_update_ms, m_render_ms;
+    //in microseconds, the updates are recorded by the simulation itself
+    Histogram m_render_hist;
+
+    std::unique_ptr<FrameCapture> m_capture;
+    int m_num_captures, m_num_traces, m_num_cost_dumps;
+    //of the image the render buffer produces
+    int m_width, m_height;
+
+    std::thread m_thread;
+
+    void routine();
+    //returns whether there were any
+    bool run_commands();
+    void render();
+    void publish();
+
+    //----------PixelSink----------
+    void create(int width, int height) override;
+    void update(const Color *pixels, int y, int yy) override;
+};
+
+#endif
@@ -1,52 +1,113 @@
 #include "simulation.hpp"
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <numeric>
 #include <random>
+#include <chrono>
+#include <cstdio>
 #include "world.hpp"
+#include "frame_capture.hpp"
+#include "palette.hpp"
+#include "region_store.hpp"
+#include "terrain.hpp"
 
-const uint16_t TIME_STEP_MILLIS = FIXED_TIME_STEP.asMilliseconds();
+const uint16_t TIME_STEP_MILLIS = static_cast<uint16_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(FIXED_TIME_STEP).count());
 
 //in millis
 const uint16_t FIRE_LT_MEAN = 3000;
 const uint16_t FIRE_LT_DEV = 1000;
 const uint16_t FIRE_IGNITE_THRESHOLD = 3000;
 
-const size_t NUM_FIRE_FLICKERS = 5;
-const sf::Time FLICKER_DURATION = sf::milliseconds(100);
-const sf::Color FIRE_FLICKER_COLORS[NUM_FIRE_FLICKERS] = {
-    //  R,   G,   B,   A
-    { 255, 255,   0, 255 },
-    { 255, 200,   0, 255 },
-    { 255, 150,   0, 255 },
-    { 255, 100,   0, 255 },
-    { 255,  50,   0, 255 },
-};
+//the chunks up to this far off screen get updated every NEAR_INTERVAL ticks,
+//the rest every FAR_INTERVAL ticks, each block in a different tick
+const int NEAR_MARGIN = 256;
+const int NEAR_INTERVAL = 2;
+const int FAR_INTERVAL = 4;
 
 const uint16_t SAND_FREEFALL_ACC = 2;
 const uint16_t MAX_FREEFALL_SPD = UINT16_MAX;
 
-using V2i = sf::Vector2i;
+struct Offset {
+    int x, y;
+};
 
-const V2i OFFS[8] = {
+const Offset OFFS[8] = {
     { -1, -1 }, { 0, -1 }, { 1, -1 },
     { -1,  0 }, { 1,  0 },
     { -1,  1 }, { 0,  1 }, { 1,  1 }
 };
 
+static_assert(Chunk::NUM_LODS == RenderBuffer::NUM_LODS, "mismatched levels of detail");
+static_assert(Chunk::SIZE % (1 << (Chunk::NUM_LODS - 1)) == 0, "chunks must be divisible by the coarsest level");
+
 const size_t VISIBLE_WIDTH = 1024;
 const size_t VISIBLE_HEIGHT = 512;
 
-Simulation::Simulation()
-    : m_buffer(VISIBLE_WIDTH, VISIBLE_HEIGHT), m_water_spread(8), 
-      m_upd_vdir(0), m_upd_hdir(0), m_upd_dir_state(1), m_world(new World()),
-      m_view(0, 0, VISIBLE_WIDTH - 1, VISIBLE_HEIGHT - 1),
-      m_scheduler(*this, 3)
+//splitmix64, so that neighbouring seeds give unrelated states
+static XorShift::State seed_state(uint32_t seed, size_t idx) {
+    uint64_t z = (static_cast<uint64_t>(seed) << 8) + idx;
+    XorShift::State state;
+    for (auto &x: state.x) {
+        z += 0x9E3779B97F4A7C15ull;
+        uint64_t r = z;
+        r = (r ^ (r >> 30)) * 0xBF58476D1CE4E5B9ull;
+        r = (r ^ (r >> 27)) * 0x94D049BB133111EBull;
+        x = r ^ (r >> 31);
+    }
+    return state;
+}
+
+//mixes the rolls of a chunk in a tick, whichever thread updates it
+static size_t chunk_seed_idx(uint64_t tick, size_t ch_x, size_t ch_y) {
+    uint64_t z = (tick * 0x9E3779B97F4A7C15ull) ^ (static_cast<uint64_t>(ch_y) << 32) ^ ch_x;
+    return static_cast<size_t>(z ^ (z >> 29));
+}
+
+static float millis_since(std::chrono::steady_clock::time_point &t) {
+    auto now = std::chrono::steady_clock::now();
+    float ms = std::chrono::duration<float, std::milli>(now - t).count();
+    t = now;
+    return ms;
+}
+
+static std::unique_ptr<RegionStore> make_store(const std::string &dir) {
+    if (dir.empty())
+        return nullptr;
+    return std::unique_ptr<RegionStore>(new RegionStore(dir));
+}
+
+static std::unique_ptr<TerrainGenerator> make_generator(const SimulationConfig &config) {
+    if (!config.generate_terrain)
+        return nullptr;
+    //as many threads as the simulation itself
+    return std::unique_ptr<TerrainGenerator>(new TerrainGenerator(config.seed, config.num_threads + 1));
+}
+
+Simulation::Simulation(PixelSink &sink, const SimulationConfig &config)
+    : m_world(new World(make_store(config.storage_dir), config.cache_budget, make_generator(config))), 
+      m_buffer(VISIBLE_WIDTH, VISIBLE_HEIGHT, sink),
+      m_scheduler(*this, config.num_threads), m_capture(nullptr), 
+      m_memory_report_interval(config.memory_report_interval), m_water_spread(8), 
+      m_sim_lod(config.sim_lod), m_hashing(config.hash_world), m_tick(0),
+      m_upd_vdir(0), m_upd_hdir(0), m_upd_dir_state(1),
+      m_view(0, 0, VISIBLE_WIDTH - 1, VISIBLE_HEIGHT - 1)
 {
+    assert(config.num_threads < MAX_THREADS);
     std::fill(std::begin(m_updated_particles), std::end(m_updated_particles), 0);
     std::fill(std::begin(m_tested_particles), std::end(m_tested_particles), 0);
+    std::fill(std::begin(m_chunk_ticks), std::end(m_chunk_ticks), 1);
+    for (size_t i = 0; i < MAX_THREADS; ++i)
+        m_gens[i] = XorShift(seed_state(config.seed, i));
+    m_gen = XorShift(seed_state(config.seed, MAX_THREADS));
+    m_seed = config.seed;
+    m_scheduler.set_reversed(config.reverse_chunk_order);
+    m_phase_times = PhaseTimes{};
 }
 
+Simulation::~Simulation() = default;
+
 void Simulation::update() {
     switch (m_upd_dir_state) {
     case 1:
@@ -70,25 +131,146 @@ void Simulation::update() {
     };
     std::fill(std::begin(m_updated_particles), std::end(m_updated_particles), 0);
     std::fill(std::begin(m_tested_particles), std::end(m_tested_particles), 0);
-    m_world->fit_dirty_rects(false);
+    auto t = std::chrono::steady_clock::now();
+    m_world->poll_io();
+    m_phase_times.io = millis_since(t);
+    apply_edits();
+    m_phase_times.edit = millis_since(t);
+
+    //the dirty rects spilling over the chunk borders get pulled in by the neighbours,
+    //block by block in parallel
+    auto fit = [this](size_t blk_x, size_t blk_y, Block&) {
+        m_scheduler.push_block(blk_x, blk_y);
+    };
+    m_scheduler.clear();
+    m_world->enumerate_active_blocks(fit);
+    m_scheduler.run(scheduler::Propagate);
+    m_phase_times.propagate = millis_since(t);
 
     auto f = [this](size_t blk_x, size_t blk_y, Block &blk) {
         size_t offx = blk_x * Block::N, offy = blk_y * Block::N;
-        for (size_t j = 0; j < Block::N; ++j)
-            for (size_t i = 0; i < Block::N; ++i)
-                m_scheduler.push_chunk(offx + i, offy + j, &blk.chunks[j][i]);
+        //most of the resident chunks are idle, they'd only cost the scheduler a lock each
+        for (size_t j = 0; j < Block::N; ++j) {
+            for (size_t i = 0; i < Block::N; ++i) {
+                auto &ch = blk.chunks[j][i];
+                if (!ch.is_dirty())
+                    continue;
+                if (is_due(offx + i, offy + j, update_interval(offx + i, offy + j)))
+                    m_scheduler.push_chunk(offx + i, offy + j, &ch);
+                else
+                    //nothing marks it while it waits, it has to stay dirty on its own
+                    ch.next_dirty_rect.include(ch.cur_dirty_rect);
+            }
+        }
     };
     m_scheduler.clear();
-    m_world->enumerate_blocks(f);
+    m_world->enumerate_active_blocks(f);
+    m_phase_times.schedule = millis_since(t);
 
     m_scheduler.run(scheduler::Prepare);
+    m_phase_times.prepare = millis_since(t);
     m_scheduler.run(scheduler::Update);
+    m_phase_times.update = millis_since(t);
+
+    //whatever got written to since the last time has a rect, either still the next one
+    //or the current one it was moved into
+    if (m_hashing) {
+        auto changed = [&](size_t blk_x, size_t blk_y, Block &blk) {
+            size_t offx = blk_x * Block::N, offy = blk_y * Block::N;
+            for (size_t j = 0; j < Block::N; ++j)
+                for (size_t i = 0; i < Block::N; ++i) {
+                    Chunk &ch = blk.chunks[j][i];
+                    if (!ch.cur_dirty_rect.is_empty() || !ch.next_dirty_rect.is_empty())
+                        m_scheduler.push_chunk(offx + i, offy + j, &ch);
+                }
+        };
+        m_scheduler.clear();
+        m_world->enumerate_blocks(changed);
+        m_scheduler.run(scheduler::Hash);
+    }
+    m_phase_times.hash = millis_since(t);
+    record_phase_times();
 
-    std::uniform_int<int8_t> dist(1, 4);
-    m_upd_dir_state = dist(m_gens[0]);
+    std::uniform_int_distribution<int> dist(1, 4);
+    m_upd_dir_state = static_cast<int8_t>(dist(m_gen));
+    ++m_tick;
+
+    sample_memory();
+    if (m_memory_report_interval && m_tick % m_memory_report_interval == 0) {
+        printf("tick %llu\n", static_cast<unsigned long long>(m_tick));
+        print_memory_usage(m_memory);
+    }
+}
+
+void Simulation::sample_memory() {
+    size_t values[NUM_MEMORY_CATEGORIES];
+    values[ResidentMemory] = m_world->resident_bytes();
+    values[SnapshotMemory] = m_world->snapshot_bytes();
+    values[CacheMemory] = m_world->cache_bytes();
+    values[StagingMemory] = m_world->staging_bytes();
+    values[RenderMemory] = m_buffer.memory_bytes();
+    values[SchedulerMemory] = m_scheduler.memory_bytes();
+    values[SimulationMemory] = sizeof(Simulation) - sizeof(RenderBuffer) - sizeof(UpdateScheduler)
+        + (m_costs ? m_costs->memory_bytes() : 0) + (m_flush_counters ? sizeof(PerfCounters) : 0)
+        + m_applying.capacity() * sizeof(Edit) + m_edit_chunks.capacity() * sizeof(std::pair<size_t, size_t>);
+    for (auto &spans: m_spans)
+        values[SimulationMemory] += spans.capacity() * sizeof(std::pair<int, int>);
+    for (auto &crossings: m_crossings)
+        values[SimulationMemory] += crossings.capacity() * sizeof(double);
+    m_memory.sample(values);
+}
+
+void Simulation::record_phase_times() {
+    auto record = [](Histogram &h, float ms) {
+        h.record(static_cast<uint64_t>(ms * 1e3f));
+    };
+    const PhaseTimes &pt = m_phase_times;
+    record(m_phase_hists.io, pt.io);
+    record(m_phase_hists.edit, pt.edit);
+    record(m_phase_hists.propagate, pt.propagate);
+    record(m_phase_hists.schedule, pt.schedule);
+    record(m_phase_hists.prepare, pt.prepare);
+    record(m_phase_hists.update, pt.update);
+    record(m_phase_hists.hash, pt.hash);
+    record(m_phase_hists.total, pt.io + pt.edit + pt.propagate + pt.schedule + pt.prepare + pt.update + pt.hash);
+}
+
+const Histogram& Simulation::busy_histogram(size_t thread) const {
+    return m_scheduler.busy_histogram(thread);
+}
+
+void Simulation::reset_histograms() {
+    for (Histogram *h: { &m_phase_hists.io, &m_phase_hists.edit, &m_phase_hists.propagate, &m_phase_hists.schedule,
+            &m_phase_hists.prepare, &m_phase_hists.update, &m_phase_hists.hash, &m_phase_hists.total })
+        h->reset();
+    m_scheduler.reset_histograms();
+}
+
+int Simulation::update_interval(size_t ch_x, size_t ch_y) const {
+    if (!m_sim_lod)
+        return 1;
+    Rect<int> bounds = chunk_bounds(ch_x, ch_y), view(m_view);
+    if (bounds.intersects(view))
+        return 1;
+    Rect<int> near(view.left - NEAR_MARGIN, view.top - NEAR_MARGIN, 
+            view.right + NEAR_MARGIN, view.bottom + NEAR_MARGIN);
+    return bounds.intersects(near) ? NEAR_INTERVAL : FAR_INTERVAL;
+}
+
+bool Simulation::is_due(size_t ch_x, size_t ch_y, int interval) const {
+    //whole blocks take turns, so the work gets spread evenly over the ticks
+    size_t blk_x = ch_x / Block::N, blk_y = ch_y / Block::N;
+    return (m_tick + blk_x + 2 * blk_y) % interval == 0;
+}
+
+void Simulation::fit_block(size_t blk_x, size_t blk_y, size_t worker_idx) {
+    m_world->fit_block(blk_x, blk_y);
 }
 
 void Simulation::prepare_chunk(size_t ch_x, size_t ch_y, Chunk &ch, size_t worker_idx) {
+    //all the neighbours have gathered it by now; a chunk with a next rect always ends up dirty,
+    //as the rect covers at least the cell that got marked
+    ch.next_dirty_rect.reset();
     if (!ch.is_dirty())
         return;
     auto bounds = chunk_bounds(ch_x, ch_y).intersection(ch.cur_dirty_rect);
@@ -102,6 +284,8 @@ void Simulation::prepare_chunk(size_t ch_x, size_t ch_y, Chunk &ch, size_t worke
 
 void Simulation::update_chunk(size_t ch_x, size_t ch_y, Chunk &ch, size_t worker_idx) {
     const Rect<int> &r = ch.cur_dirty_rect;
+    m_chunk_ticks[worker_idx] = update_interval(ch_x, ch_y);
+    m_gens[worker_idx] = XorShift(seed_state(m_seed, chunk_seed_idx(m_tick, ch_x, ch_y)));
     /* ch.cur_dirty_rect.reset(); */
     /* Rect<int> r = chunk_bounds(ch_x, ch_y); */
     /* auto get_particle = [&ch](size_t x, size_t y) -> Particle& { */
@@ -131,6 +315,74 @@ void Simulation::update_chunk(size_t ch_x, size_t ch_y, Chunk &ch, size_t worker
     }
 }
 
+void Simulation::hash_chunk(size_t ch_x, size_t ch_y, size_t worker_idx) {
+    m_world->rehash_chunk(ch_x, ch_y);
+}
+
+void Simulation::record_chunk_cost(size_t ch_x, size_t ch_y, uint64_t nanos, int updated, int tested) {
+    m_costs->record(ch_x, ch_y, m_tick, UpdateTime, nanos * 1e-3f);
+    m_costs->record(ch_x, ch_y, m_tick, Updated, static_cast<float>(updated));
+    m_costs->record(ch_x, ch_y, m_tick, Tested, static_cast<float>(tested));
+}
+
+void Simulation::record_straggler(size_t ch_x, size_t ch_y) {
+    m_costs->record(ch_x, ch_y, m_tick, Straggler, 1.f);
+}
+
+void Simulation::set_cost_tracking(bool enabled) {
+    if (enabled && !m_scheduler.is_cost_tracking()) {
+        if (m_costs)
+            m_costs->clear();
+        else
+            //the ring covers every resident chunk
+            m_costs.reset(new ChunkCosts(World::RING_SIZE * Block::N));
+    }
+    m_scheduler.set_cost_tracking(enabled);
+}
+
+bool Simulation::is_cost_tracking() const {
+    return m_scheduler.is_cost_tracking();
+}
+
+ChunkCost Simulation::chunk_cost(size_t ch_x, size_t ch_y) const {
+    return m_costs ? m_costs->get(ch_x, ch_y, m_tick) : ChunkCost();
+}
+
+bool Simulation::save_cost_csv(const std::string &path) const {
+    return m_costs && m_costs->write_csv(path, m_tick);
+}
+
+bool Simulation::save_cost_heatmap(const std::string &path, ChunkMetric metric) const {
+    return m_costs && m_costs->write_ppm(path, m_tick, metric);
+}
+
+void Simulation::set_hashing(bool enabled) {
+    //whatever happened meanwhile went unnoticed
+    if (enabled && !m_hashing)
+        m_world->invalidate_hashes();
+    m_hashing = enabled;
+}
+
+uint64_t Simulation::world_hash() {
+    return m_hashing ? m_world->world_hash() : m_world->compute_world_hash();
+}
+
+uint64_t Simulation::block_hash(size_t blk_x, size_t blk_y) {
+    if (!m_hashing)
+        m_world->invalidate_hashes();
+    return m_world->block_hash(blk_x, blk_y);
+}
+
+uint64_t Simulation::chunk_hash(size_t ch_x, size_t ch_y) {
+    if (!m_hashing)
+        m_world->invalidate_hashes();
+    return m_world->chunk_hash(ch_x, ch_y);
+}
+
+uint64_t Simulation::compute_world_hash() const {
+    return m_world->compute_world_hash();
+}
+
 void Simulation::render() {
     Rect<size_t> visible_blocks(m_view.left / Block::SIZE, m_view.top / Block::SIZE,
             m_view.right / Block::SIZE, m_view.bottom / Block::SIZE),
@@ -151,25 +403,147 @@ void Simulation::render() {
     m_scheduler.clear();
     m_world->enumerate_blocks(f);
     m_scheduler.run(scheduler::Render);
-    m_buffer.flush();
+    if (m_scheduler.is_perf_counting()) {
+        if (!m_flush_counters)
+            m_flush_counters.reset(new PerfCounters());
+        PerfSample before = m_flush_counters->read();
+        m_buffer.flush();
+        m_flush_perf += m_flush_counters->read() - before;
+    } else {
+        m_buffer.flush();
+    }
+    if (m_capture)
+        m_capture->push(m_buffer.data(), m_buffer.width(), m_buffer.height());
+    sample_memory();
 }
 
 void Simulation::render_chunk(size_t ch_x, size_t ch_y, Chunk& ch, size_t worker_idx) {
-    auto get_particle = [&ch](size_t x, size_t y) -> Particle& {
-        return ch.data[y % Chunk::SIZE][x % Chunk::SIZE];
-    };
-    Rect<int> r = ch.needs_redrawing;
+    int lod = m_buffer.lod();
+    Rect<int> r = ch.needs_redrawing[lod];
     if (r.is_empty())
         return;
-    ch.needs_redrawing.reset();
+    ch.needs_redrawing[lod].reset();
+    if (m_scheduler.is_cost_tracking())
+        m_costs->record(ch_x, ch_y, m_tick, Redrawn, static_cast<float>(r.area()));
     /* Rect<int> r = chunk_bounds(ch_x, ch_y); */
-    for (size_t y = r.top; y <= r.bottom; ++y) {
-        for (size_t x = r.left; x <= r.right; ++x) {
-            redraw_particle(x, y, get_particle(x, y));
+    //the view is aligned to chunks, so the chunk is entirely on screen
+    int ox = static_cast<int>(m_view.left), oy = static_cast<int>(m_view.top);
+    if (ch.is_uniform) {
+        Color c = particle_color(ch.uniform);
+        Rect<int> scaled(r.left >> lod, r.top >> lod, r.right >> lod, r.bottom >> lod);
+        for (int y = scaled.top; y <= scaled.bottom; ++y) {
+            Color *row = m_buffer.row(y - (oy >> lod)) + scaled.left - (ox >> lod);
+            std::fill(row, row + scaled.width(), c);
         }
+        return;
+    }
+
+    size_t left = r.left % Chunk::SIZE;
+    if (!lod) {
+        for (int y = r.top; y <= r.bottom; ++y)
+            redraw_row(&ch.get(left, y), r.width(), m_buffer.row(y - oy) + r.left - ox);
+        return;
+    }
+
+    //each pixel covers a 2^lod square of particles; sampling just its centre
+    //keeps the cost proportional to the pixels on screen
+    int half = (1 << lod) / 2;
+    Rect<int> scaled(r.left >> lod, r.top >> lod, r.right >> lod, r.bottom >> lod);
+    left = ((scaled.left << lod) + half) % Chunk::SIZE;
+    for (int y = scaled.top; y <= scaled.bottom; ++y) {
+        redraw_row(&ch.get(left, (y << lod) + half), size_t(1) << lod, 
+                scaled.width(), m_buffer.row(y - (oy >> lod)) + scaled.left - (ox >> lod));
     }
 }
 
+void Simulation::set_camera(int left, int top, float vx, float vy) {
+    //snapping to chunks keeps every chunk either entirely on screen or not at all
+    size_t l = std::max(left, 0) / Chunk::SIZE * Chunk::SIZE,
+           t = std::max(top, 0) / Chunk::SIZE * Chunk::SIZE;
+    if (l != m_view.left || t != m_view.top) {
+        m_view = Rect<size_t>(l, t, l + VISIBLE_WIDTH - 1, t + VISIBLE_HEIGHT - 1);
+        invalidate_view();
+    }
+    m_world->prefetch(static_cast<Rect<int>>(m_view), vx, vy);
+}
+
+const Rect<size_t>& Simulation::view() const {
+    return m_view;
+}
+
+bool Simulation::save_snapshot(const std::string &path) {
+    return m_world->save_snapshot(path);
+}
+
+size_t Simulation::snapshot_chunks_written() const {
+    return m_world->snapshot_chunks_written();
+}
+
+bool Simulation::load_snapshot(const std::string &path) {
+    if (!m_world->load_snapshot(path))
+        return false;
+    invalidate_view();
+    return true;
+}
+
+void Simulation::invalidate_view() {
+    m_buffer.clear(Color::Black);
+    for (size_t ch_y = m_view.top / Chunk::SIZE; ch_y <= m_view.bottom / Chunk::SIZE; ++ch_y) {
+        for (size_t ch_x = m_view.left / Chunk::SIZE; ch_x <= m_view.right / Chunk::SIZE; ++ch_x) {
+            if (!m_world->is_chunk_loaded(ch_x, ch_y))
+                continue;
+            for (auto &r: m_world->get_chunk(ch_x, ch_y).needs_redrawing)
+                r = chunk_bounds(ch_x, ch_y);
+        }
+    }
+}
+
+void Simulation::set_zoom(float zoom) {
+    int lod = zoom > 1.f ? static_cast<int>(std::log2(zoom)) : 0;
+    m_buffer.set_lod(std::min(lod, RenderBuffer::NUM_LODS - 1));
+}
+
+int Simulation::lod() const {
+    return m_buffer.lod();
+}
+
+void Simulation::set_capture(FrameCapture *capture) {
+    m_capture = capture;
+}
+
+void Simulation::set_tracing(bool enabled) {
+    Tracer &tracer = m_scheduler.tracer();
+    if (enabled && !tracer.enabled())
+        tracer.clear();
+    tracer.set_enabled(enabled);
+}
+
+bool Simulation::is_tracing() const {
+    return m_scheduler.tracer().enabled();
+}
+
+bool Simulation::save_trace(const std::string &path) const {
+    return m_scheduler.tracer().write_chrome_json(path);
+}
+
+void Simulation::set_perf_counting(bool enabled) {
+    if (enabled && !m_scheduler.is_perf_counting())
+        m_flush_perf = PerfSample();
+    m_scheduler.set_perf_counting(enabled);
+}
+
+const PerfSample& Simulation::perf_totals(size_t thread, scheduler::Mode mode) const {
+    return m_scheduler.perf_totals(thread, mode);
+}
+
+const PerfSample& Simulation::flush_perf_totals() const {
+    return m_flush_perf;
+}
+
+size_t Simulation::num_threads() const {
+    return m_scheduler.num_threads();
+}
+
 void Simulation::update_particle(int x, int y, Chunk &ch, Particle &p, size_t worker_idx) {
     ++m_tested_particles[worker_idx];
     if (p.been_updated())
@@ -201,9 +575,11 @@ void Simulation::update_particle(int x, int y, Chunk &ch, Sand &p, size_t worker
         return p.is<None>() || p.is<Water>();
     };
 
-    if (p.vy < MAX_FREEFALL_SPD)
-        p.vy += SAND_FREEFALL_ACC; //gravity
-    int n = std::max(1, p.vy / 16), orig_x = x, orig_y = y;
+    int ticks = m_chunk_ticks[worker_idx];
+    //gravity
+    p.vy = static_cast<uint16_t>(std::min<int>(MAX_FREEFALL_SPD, p.vy + SAND_FREEFALL_ACC * ticks));
+    //a grain mustn't get past the neighbouring chunk, the next one along might be updated by another thread
+    int n = std::min<int>(std::max(1, p.vy / 16) * ticks, Chunk::SIZE), orig_x = x, orig_y = y;
     while (n--) {
         if (!m_world->is_particle_loaded(x, y + 1)) {
             p.vy = 0;
@@ -212,7 +588,7 @@ void Simulation::update_particle(int x, int y, Chunk &ch, Sand &p, size_t worker
 
         if (test(x, y + 1)) {
             ++y;
-        } else if (x > 0 && test(x - 1, y + 1)) {
+        } else if (m_world->is_particle_loaded(x - 1, y + 1) && test(x - 1, y + 1)) {
             ++y; --x;
         } else if (m_world->is_particle_loaded(x + 1, y + 1) && test(x + 1, y + 1)) {
             ++y; ++x;
@@ -240,8 +616,8 @@ void Simulation::update_particle(int x, int y, Chunk &ch, Water &p, size_t worke
         return result;
     };
 
-    int orig_x = x, orig_y = y;
-    for (int i = 0; i < m_water_spread; ++i) {
+    int orig_x = x, orig_y = y, spread = m_water_spread * m_chunk_ticks[worker_idx];
+    for (int i = 0; i < spread; ++i) {
         can_any = false;
 
         if (m_world->is_particle_loaded(x, y + 1)) {
@@ -250,7 +626,7 @@ void Simulation::update_particle(int x, int y, Chunk &ch, Water &p, size_t worke
                 continue;
             } 
 
-            if (x > 0 && is_none(x - 1, y + 1) && p.flow_dir < 0) {
+            if (m_world->is_particle_loaded(x - 1, y + 1) && is_none(x - 1, y + 1) && p.flow_dir < 0) {
                 ++y; --x;
                 continue;
             }
@@ -261,7 +637,7 @@ void Simulation::update_particle(int x, int y, Chunk &ch, Water &p, size_t worke
             }
         }
 
-        if (x > 0 && is_none(x - 1, y) && p.flow_dir < 0) {
+        if (m_world->is_particle_loaded(x - 1, y) && is_none(x - 1, y) && p.flow_dir < 0) {
             --x;
         } else if (m_world->is_particle_loaded(x + 1, y) && is_none(x + 1, y) && p.flow_dir > 0) {
             ++x;
@@ -280,102 +656,167 @@ void Simulation::update_particle(int x, int y, Chunk &ch, Water &p, size_t worke
 }
 
 void Simulation::update_particle(int x, int y, Chunk &ch, Fire &p, size_t worker_idx) {
-    std::uniform_int_distribution<uint16_t> ignite_roll(0, p.lifetime);
+    int ticks = m_chunk_ticks[worker_idx];
+    spread_fire(x, y, p.lifetime, ticks, worker_idx);
+    
+    uint16_t elapsed = static_cast<uint16_t>(TIME_STEP_MILLIS * ticks);
+    if (p.lifetime < elapsed) {
+        ch.get(x, y) = Particle();
+        mark_with_neighbours(x, y);
+    } else {
+        p.lifetime -= elapsed;
+        mark(x, y);
+    }
+}
+
+void Simulation::spread_fire(int x, int y, uint16_t lifetime, int ticks, size_t worker_idx) {
+    std::uniform_int_distribution<uint16_t> ignite_roll(0, lifetime);
     auto &gen = m_gens[worker_idx];
-    if (ignite_roll(gen) < FIRE_IGNITE_THRESHOLD) {
+    for (int t = 0; t < ticks; ++t) {
+        if (ignite_roll(gen) >= FIRE_IGNITE_THRESHOLD)
+            continue;
         size_t idx = std::uniform_int_distribution<size_t>(0, 7)(gen);
 
-        V2i pos = OFFS[idx] + V2i(x, y);
+        Offset pos{ x + OFFS[idx].x, y + OFFS[idx].y };
         if (pos.x >= 0 && pos.y >= 0 && m_world->is_particle_loaded(pos.x, pos.y) 
                 && m_world->get(pos.x, pos.y).is<Wood>())
         {
             Particle q = Particle::create<Fire>();
             std::uniform_int_distribution<uint16_t> dist(0, 2 * FIRE_LT_DEV);
             q.as.fire.lifetime = FIRE_LT_MEAN + dist(gen) - FIRE_LT_DEV;
+            //the new fire has been burning for the rest of the ticks covered,
+            //it catches up right away instead of waiting for the next update
+            int left = ticks - t - 1;
+            if (left) {
+                q.set_updated<true>();
+                q.as.fire.lifetime -= static_cast<uint16_t>(TIME_STEP_MILLIS * left);
+            }
             m_world->get(pos.x, pos.y) = q;
             mark(pos.x, pos.y);
+            if (left)
+                spread_fire(pos.x, pos.y, q.as.fire.lifetime, left, worker_idx);
         }
     }
-    
-    if (p.lifetime < TIME_STEP_MILLIS) {
-        ch.get(x, y) = Particle();
-        mark_with_neighbours(x, y);
-    } else {
-        p.lifetime -= TIME_STEP_MILLIS;
-        mark(x, y);
+}
+
+void Simulation::spawn_cloud(int cx, int cy, int r, ParticleType pt) {
+    queue_edit(Edit::circle(cx, cy, r, pt));
+}
+
+void Simulation::queue_edit(Edit edit) {
+    std::lock_guard<std::mutex> lock(m_edit_mtx);
+    m_edits.push_back(std::move(edit));
+}
+
+void Simulation::queue_edits(std::vector<Edit> edits) {
+    std::lock_guard<std::mutex> lock(m_edit_mtx);
+    if (m_edits.empty()) {
+        m_edits.swap(edits);
+        return;
     }
+    m_edits.insert(m_edits.end(), std::make_move_iterator(edits.begin()), std::make_move_iterator(edits.end()));
 }
 
-void Simulation::redraw_particle(int x, int y, Particle &p) {
-    switch (p.type()) {
-    case ParticleType::None:
-        m_buffer.pixel(x, y) = sf::Color::Black;
-        break;
+void Simulation::apply_edits() {
+    {
+        std::lock_guard<std::mutex> lock(m_edit_mtx);
+        m_applying.swap(m_edits);
+    }
+    if (m_applying.empty())
+        return;
+
+    //through the resident blocks, so a huge edit costs no more than the loaded chunks
+    m_edit_chunks.clear();
+    auto covered = [this](size_t blk_x, size_t blk_y, Block&) {
+        Rect<int> cells(blk_x * Block::SIZE, blk_y * Block::SIZE, 
+                (blk_x + 1) * Block::SIZE - 1, (blk_y + 1) * Block::SIZE - 1);
+        for (auto &e: m_applying) {
+            Rect<int> b = e.bounds();
+            if (b.is_empty() || !b.intersects(cells))
+                continue;
+            b = b.intersection(cells);
+            for (size_t ch_y = b.top / Chunk::SIZE; ch_y <= b.bottom / Chunk::SIZE; ++ch_y)
+                for (size_t ch_x = b.left / Chunk::SIZE; ch_x <= b.right / Chunk::SIZE; ++ch_x)
+                    m_edit_chunks.emplace_back(ch_x, ch_y);
+        }
+    };
+    m_world->enumerate_blocks(covered);
+    std::sort(m_edit_chunks.begin(), m_edit_chunks.end());
+    m_edit_chunks.erase(std::unique(m_edit_chunks.begin(), m_edit_chunks.end()), m_edit_chunks.end());
+
+    //the chunks only write into themselves, the groups just spread them over the threads
+    m_scheduler.clear();
+    for (auto &i: m_edit_chunks)
+        m_scheduler.push_chunk(i.first, i.second, &m_world->get_chunk(i.first, i.second));
+    m_scheduler.run(scheduler::ApplyEdits);
+    m_applying.clear();
+}
+
+static Particle create_particle(ParticleType pt, XorShift &gen) {
+    switch (pt) {
     case ParticleType::Sand:
-        m_buffer.pixel(x, y) = sf::Color::Yellow;
-        break;
+        return Particle::create<Sand>();
     case ParticleType::Water:
-        m_buffer.pixel(x, y) = sf::Color::Blue;
-        break;
+        return Particle::create<Water>();
     case ParticleType::Wood:
-        m_buffer.pixel(x, y) = sf::Color(80, 0, 0);
-        break;
-    case ParticleType::Fire:
-    {
-        size_t idx = p.as.fire.lifetime / FLICKER_DURATION.asMilliseconds();
-        m_buffer.pixel(x, y) = FIRE_FLICKER_COLORS[idx % NUM_FIRE_FLICKERS];
-        break;
+        return Particle::create<Wood>();
+    case ParticleType::Fire: {
+        Particle p = Particle::create<Fire>();
+        std::uniform_int_distribution<uint16_t> dist(0, FIRE_LT_DEV * 2);
+        p.as.fire.lifetime = FIRE_LT_MEAN + dist(gen) - FIRE_LT_DEV;
+        return p;
     }
     default:
-        break;
+        return Particle::create<None>();
     }
 }
 
-const sf::Texture& Simulation::get_texture() const {
-    return m_buffer.get_texture();
-}
-
-void Simulation::spawn_cloud(int cx, int cy, int r, ParticleType pt) {
-    auto distance = [=](int x, int y) {
-        int dx = x - cx, dy = y - cy;
-        return dx * dx + dy * dy;
-    };
-    Rect<int> rect(cx - r, cy - r, cx + r, cy + r);
-    rect = rect.intersection(static_cast<Rect<int>>(m_view));
-    std::uniform_int_distribution<uint16_t> dist(0, FIRE_LT_DEV * 2);
-
-    int st = pt == ParticleType::Water || pt == ParticleType::Sand ? 2 : 1;
-    st = 1;
-    for (int y = rect.top; y <= rect.bottom; y += st) {
-        for (int x = rect.left; x <= rect.right; x += st) {
-            if (distance(x, y) <= r*r) {
-                Particle p;
-                switch (pt) {
-                case ParticleType::None:
-                    p = Particle::create<None>();
-                    break;
-                case ParticleType::Sand:
-                    p = Particle::create<Sand>();
-                    break;
-                case ParticleType::Water:
-                    p = Particle::create<Water>();
-                    break;
-                case ParticleType::Wood:
-                    p = Particle::create<Wood>();
-                    break;
-                case ParticleType::Fire:
-                    p = Particle::create<Fire>();
-                    p.as.fire.lifetime = FIRE_LT_MEAN + dist(m_gens[0]) - FIRE_LT_DEV;
-                    break;
-                default:
-                    break;
-                };
-                m_world->get(x, y) = p;
-                mark_with_neighbours(x, y);
+void Simulation::edit_chunk(size_t ch_x, size_t ch_y, Chunk &ch, size_t worker_idx) {
+    //the fire lifetimes don't depend on the thread either
+    auto &gen = m_gens[worker_idx];
+    gen = XorShift(seed_state(m_seed, ~chunk_seed_idx(m_tick, ch_x, ch_y)));
+    Rect<int> bounds = chunk_bounds(ch_x, ch_y), written;
+    written.reset();
+    auto &spans = m_spans[worker_idx];
+    for (auto &e: m_applying) {
+        Rect<int> b = e.bounds();
+        if (b.is_empty() || !b.intersects(bounds))
+            continue;
+        b = b.intersection(bounds);
+        for (int y = b.top; y <= b.bottom; ++y) {
+            spans.clear();
+            e.row_spans(y, spans, m_crossings[worker_idx]);
+            Particle *row = ch.data[y - bounds.top];
+            for (auto &span: spans) {
+                int x0 = std::max(span.first, b.left), x1 = std::min(span.second, b.right);
+                if (x0 > x1)
+                    continue;
+                if (e.shape != Edit::Stamp) {
+                    for (int x = x0; x <= x1; ++x)
+                        row[x - bounds.left] = create_particle(e.type, gen);
+                } else {
+                    for (int x = x0; x <= x1; ++x) {
+                        ParticleType pt = e.stamp_cell(x, y);
+                        if (pt != ParticleType::None || e.opaque)
+                            row[x - bounds.left] = create_particle(pt, gen);
+                    }
+                }
+                written.include(Rect<int>(x0, y, x1, y));
             }
         }
     }
-//    m_world->fit_dirty_rects();
+    if (written.is_empty())
+        return;
+
+    //once for the whole chunk, with the neighbours that might now move
+    ch.next_dirty_rect.include(Rect<int>(written.left - 1, written.top - 1, written.right + 1, written.bottom + 1));
+    size_t blk_x = ch_x / Block::N, blk_y = ch_y / Block::N;
+    m_world->mark_active(blk_x, blk_y);
+    Rect<int> blk_bounds(blk_x * Block::SIZE, blk_y * Block::SIZE, 
+            (blk_x + 1) * Block::SIZE - 1, (blk_y + 1) * Block::SIZE - 1);
+    if (written.left == blk_bounds.left || written.top == blk_bounds.top
+            || written.right == blk_bounds.right || written.bottom == blk_bounds.bottom)
+        m_world->mark_active_around(blk_x, blk_y);
 }
 
 const Rect<int>& Simulation::chunk_dirty_rect_next(int ch_x, int ch_y) const {
@@ -386,10 +827,26 @@ const Rect<int>& Simulation::chunk_dirty_rect_cur(int ch_x, int ch_y) const {
     return m_world->get_chunk(ch_x, ch_y).cur_dirty_rect;
 }
 
+const Rect<int>& Simulation::chunk_redraw_rect(int ch_x, int ch_y) const {
+    return m_world->get_chunk(ch_x, ch_y).needs_redrawing[m_buffer.lod()];
+}
+
+bool Simulation::is_chunk_loaded(int ch_x, int ch_y) const {
+    return ch_x >= 0 && ch_y >= 0 && m_world->is_chunk_loaded(ch_x, ch_y);
+}
+
 bool Simulation::is_chunk_dirty(int ch_x, int ch_y) const {
     return m_world->get_chunk(ch_x, ch_y).is_dirty();
 }
 
+bool Simulation::is_particle_loaded(int x, int y) const {
+    return x >= 0 && y >= 0 && m_world->is_particle_loaded(x, y);
+}
+
+Particle Simulation::get_particle(int x, int y) const {
+    return is_particle_loaded(x, y) ? m_world->get(x, y) : Particle();
+}
+
 int Simulation::num_updated_particles() const { 
     return std::accumulate(std::begin(m_updated_particles), std::end(m_updated_particles), 0); 
 }
@@ -412,11 +869,18 @@ void Simulation::mark(int x, int y) {
     size_t xx = static_cast<size_t>(x), yy = static_cast<size_t>(y);
     auto &ch = m_world->get_chunk(xx / Chunk::SIZE, yy / Chunk::SIZE);
     ch.next_dirty_rect.include<false>(x, y);
+    m_world->mark_active(xx / Block::SIZE, yy / Block::SIZE);
 }
 
 void Simulation::mark_with_neighbours(int x, int y) {
     size_t xx = static_cast<size_t>(x), yy = static_cast<size_t>(y);
     auto &ch = m_world->get_chunk(xx / Chunk::SIZE, yy / Chunk::SIZE);
     ch.next_dirty_rect.include<true>(x, y);
+    size_t blk_x = xx / Block::SIZE, blk_y = yy / Block::SIZE;
+    m_world->mark_active(blk_x, blk_y);
+    //the rect pokes into the neighbouring blocks
+    size_t bx = xx % Block::SIZE, by = yy % Block::SIZE;
+    if (bx == 0 || by == 0 || bx == Block::SIZE - 1 || by == Block::SIZE - 1)
+        m_world->mark_active_around(blk_x, blk_y);
 }
 
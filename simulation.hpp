@@ -1,18 +1,49 @@
 #ifndef SIMULATION_HPP
 #define SIMULATION_HPP
 
-#include <SFML/System/Time.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <utility>
 #include "render_buffer.hpp"
 #include "xorshift.hpp"
 #include "updatescheduler.hpp"
 #include "particle.hpp"
 #include "rect.hpp"
+#include "chunk_costs.hpp"
+#include "memory_usage.hpp"
+#include "edit.hpp"
 
 //60 ticks/s
-const sf::Time FIXED_TIME_STEP = sf::seconds(1.f / 60);
+const std::chrono::microseconds FIXED_TIME_STEP(1000000 / 60);
 const size_t MAX_THREADS = 8;
 
 class World;
+class FrameCapture;
+
+struct SimulationConfig {
+    //doesn't count the calling thread, which also does its share of work
+    size_t num_threads = 3;
+    //with a storage directory, the blocks leaving the resident window are kept on disk
+    std::string storage_dir;
+    //compressed in-memory cache in front of the storage, in bytes
+    size_t cache_budget = 64 << 20;
+    //fills the blocks that have never been stored with terrain;
+    //the seed picks the world and seeds the random generators of the simulation
+    bool generate_terrain = false;
+    uint32_t seed = 1;
+    //the chunks off screen get updated less often (with a longer time step), 
+    //the far ones in slices spread over the ticks
+    bool sim_lod = true;
+    //keeps the content hashes of the world up to date after every tick, see world_hash()
+    bool hash_world = false;
+    //hands the chunks of each group to the threads last to first, for checking that the order doesn't matter
+    bool reverse_chunk_order = false;
+    //ticks between the memory reports printed to stdout, 0 = never
+    uint64_t memory_report_interval = 0;
+};
 struct Block;
 struct Chunk;
 
@@ -20,20 +51,121 @@ using scheduler::UpdateScheduler;
 
 class Simulation {
     friend class UpdateScheduler;
+    //times the kernels on their own
+    friend struct MicroBench;
 public:
-    Simulation();
+    //wall time of the parts of the last update(), in milliseconds
+    struct PhaseTimes {
+        //swapping in the streamed blocks
+        float io;
+        //applying the queued edits
+        float edit;
+        //fitting the dirty rects
+        float propagate;
+        //queueing up the dirty chunks
+        float schedule;
+        float prepare;
+        float update;
+        //refreshing the content hashes, if kept
+        float hash;
+    };
+
+    //the same phases over all the updates so far, in microseconds
+    struct PhaseHistograms {
+        Histogram io, edit, propagate, schedule, prepare, update, hash;
+        //the whole update()
+        Histogram total;
+    };
+
+    //the finished frames go to the sink, which must outlive the simulation
+    explicit Simulation(PixelSink &sink, const SimulationConfig &config = SimulationConfig());
+    ~Simulation();
 
     void update();
     void render();
 
-    const sf::Texture& get_texture() const;
+    //world pixels per screen pixel, picks the level of detail for rendering:
+    //the texture gets downsampled 2^lod() times
+    void set_zoom(float zoom);
+    int lod() const;
+
+    //moves the rendered area (snapped to chunks) and streams in the blocks around it;
+    //the velocity is in pixels per tick and is used to predict the blocks needed next
+    void set_camera(int left, int top, float vx, float vy);
+    const Rect<size_t>& view() const;
+
+    //every rendered frame gets pushed to the capture, nullptr stops capturing;
+    //the capture must outlive the simulation or be detached
+    void set_capture(FrameCapture *capture);
+
+    //records what the scheduler threads are doing, starting over every time it gets enabled;
+    //save_trace() writes the last events out as Chrome trace_event JSON
+    void set_tracing(bool enabled);
+    bool is_tracing() const;
+    bool save_trace(const std::string &path) const;
+
+    //hardware counters around each phase on every thread (see UpdateScheduler::set_perf_counting()),
+    //and around flushing the finished frame on the calling thread
+    void set_perf_counting(bool enabled);
+    //the last thread is the calling one
+    const PerfSample& perf_totals(size_t thread, scheduler::Mode mode) const;
+    const PerfSample& flush_perf_totals() const;
+    size_t num_threads() const;
 
+    //what each chunk costs over the last ChunkCosts::WINDOW ticks, see ChunkMetric;
+    //starts over every time it gets enabled
+    void set_cost_tracking(bool enabled);
+    bool is_cost_tracking() const;
+    //all zeros while not tracking
+    ChunkCost chunk_cost(size_t ch_x, size_t ch_y) const;
+    bool save_cost_csv(const std::string &path) const;
+    bool save_cost_heatmap(const std::string &path, ChunkMetric metric) const;
+
+    //sampled after every update() and render()
+    const MemoryUsage& memory_usage() const { return m_memory; }
+
+    //callable from any thread; the edits get applied in order at the start of the next update(),
+    //every chunk they cover in parallel and with a single dirty rect update
+    void queue_edit(Edit edit);
+    void queue_edits(std::vector<Edit> edits);
+    //queues a filled circle
     void spawn_cloud(int cx, int cy, int r, ParticleType pt);
 
+    //content hashes of the resident world, the been-updated flags left out, so that runs of the same
+    //scenario can be compared tick by tick; the chunks that might have changed get rehashed after each update()
+    //while it's enabled, otherwise world_hash() hashes everything from scratch
+    void set_hashing(bool enabled);
+    uint64_t world_hash();
+    uint64_t block_hash(size_t blk_x, size_t blk_y);
+    uint64_t chunk_hash(size_t ch_x, size_t ch_y);
+    //from scratch, to check the kept ones against
+    uint64_t compute_world_hash() const;
+
+    //the resident part of the world; the rest lives in the storage directory,
+    //which loading doesn't roll back (see World::load_snapshot())
+    bool save_snapshot(const std::string &path);
+    //see World::snapshot_chunks_written()
+    size_t snapshot_chunks_written() const;
+    bool load_snapshot(const std::string &path);
+
     const Rect<int>& chunk_dirty_rect_next(int ch_x, int ch_y) const;
     const Rect<int>& chunk_dirty_rect_cur(int ch_x, int ch_y) const;
+    //pending redraw at the active level of detail
+    const Rect<int>& chunk_redraw_rect(int ch_x, int ch_y) const;
+    bool is_chunk_loaded(int ch_x, int ch_y) const;
     bool is_chunk_dirty(int ch_x, int ch_y) const;
+    bool is_particle_loaded(int x, int y) const;
+    //an empty particle wherever nothing is loaded
+    Particle get_particle(int x, int y) const;
+    //updates so far
+    uint64_t tick() const { return m_tick; }
 
+    const PhaseTimes& phase_times() const { return m_phase_times; }
+    const PhaseHistograms& phase_histograms() const { return m_phase_hists; }
+    //the busy time of each thread in the update phase, see UpdateScheduler::busy_histogram()
+    const Histogram& busy_histogram(size_t thread) const;
+    //starts the phase and the busy histograms over
+    void reset_histograms();
     int num_updated_particles() const;
     int num_tested_particles() const;
     const std::vector<scheduler::LoadTracker>& get_load_stats() const;
@@ -42,22 +174,56 @@ private:
     std::unique_ptr<World> m_world;
     RenderBuffer m_buffer;
     UpdateScheduler m_scheduler;
+    FrameCapture *m_capture;
+    std::unique_ptr<PerfCounters> m_flush_counters;
+    PerfSample m_flush_perf;
+    //allocated on first use
+    std::unique_ptr<ChunkCosts> m_costs;
+    MemoryUsage m_memory;
 
+    std::mutex m_edit_mtx;
+    std::vector<Edit> m_edits;
+    //taken over from m_edits for applying, so the queueing threads don't wait
+    std::vector<Edit> m_applying;
+    std::vector<std::pair<size_t, size_t>> m_edit_chunks;
     //one for each thread
+    std::vector<std::pair<int, int>> m_spans[MAX_THREADS];
+    std::vector<double> m_crossings[MAX_THREADS];
+    uint64_t m_memory_report_interval;
+
+    //one for each thread, reseeded for every chunk so the rolls don't depend on which thread got it
     XorShift m_gens[MAX_THREADS];
+    //for the calling thread between the runs
+    XorShift m_gen;
+    uint32_t m_seed;
 
     int m_updated_particles[MAX_THREADS], m_tested_particles[MAX_THREADS];
+    //how many ticks the chunk each thread is working on covers
+    int m_chunk_ticks[MAX_THREADS];
     int m_water_spread;
+    bool m_sim_lod;
+    bool m_hashing;
+    uint64_t m_tick;
+    PhaseTimes m_phase_times;
+    PhaseHistograms m_phase_hists;
     int8_t m_upd_vdir, m_upd_hdir, m_upd_dir_state;
 
     Rect<size_t> m_view;
 
+    void record_phase_times();
+    void sample_memory();
+
     //Physics
+    void fit_block(size_t blk_x, size_t blk_y, size_t worker_idx);
+
     void prepare_chunk(size_t ch_x, size_t ch_y, Chunk &ch, 
             size_t worker_idx);
 
     void update_chunk(size_t ch_x, size_t ch_y, Chunk &ch, 
             size_t worker_idx);
+    //1 on screen, more further away from it
+    int update_interval(size_t ch_x, size_t ch_y) const;
+    bool is_due(size_t ch_x, size_t ch_y, int interval) const;
 
     void update_particle(int x, int y, Chunk &ch, 
             Particle &p, size_t worker_idx);
@@ -67,11 +233,20 @@ private:
             Water &p, size_t worker_idx);
     void update_particle(int x, int y, Chunk &ch, 
             Fire &p, size_t worker_idx);
+    //a roll for every tick covered, so the fire spreads just as fast off screen
+    void spread_fire(int x, int y, uint16_t lifetime, int ticks, size_t worker_idx);
+
+    void hash_chunk(size_t ch_x, size_t ch_y, size_t worker_idx);
+    void record_chunk_cost(size_t ch_x, size_t ch_y, uint64_t nanos, int updated, int tested);
+    void record_straggler(size_t ch_x, size_t ch_y);
+    void apply_edits();
+    void edit_chunk(size_t ch_x, size_t ch_y, Chunk &ch, size_t worker_idx);
 
     //Graphics
     void render_chunk(size_t ch_x, size_t ch_y, Chunk& ch,
             size_t worker_idx);
-    void redraw_particle(int x, int y, Particle &p);
+    //redraws everything on screen from scratch
+    void invalidate_view();
 
     //utility
     void swap(int x, int y, int xx, int yy);
@@ -0,0 +1,240 @@
+#include "terrain.hpp"
+#include "world.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+const int NUM_OCTAVES = 3;
+const int MIN_SHIFT = 3;
+const int MAX_SHIFT = 8;
+//the octaves add up to 255 + 127 + 63
+const int NOISE_MAX = 445;
+
+//feature sizes, as the shift of the coarsest octave
+const int GROUND_SHIFT = 8;
+const int CAVE_SHIFT = 6;
+const int POCKET_SHIFT = 5;
+
+const int GROUND_AMPLITUDE = 100;
+//the ground right below the surface is sand, and caves don't reach into it
+const int SOIL_DEPTH = 12;
+const int CAVE_MIN_DEPTH = 20;
+const int CAVE_THRESHOLD = 290;
+const int POCKET_THRESHOLD = 300;
+
+//trees get a slot of this many columns each, and grow in one of TREE_RARITY slots
+const int TREE_SLOT_SHIFT = 4;
+const uint32_t TREE_RARITY = 5;
+const int TREE_MIN_HEIGHT = 16;
+const int TREE_MAX_HEIGHT = 56;
+
+//every field gets its own seed
+const uint32_t GROUND_SALT = 0x9e3779b9;
+const uint32_t CAVE_SALT = 0x7f4a7c15;
+const uint32_t POCKET_SALT = 0xf39cc060;
+const uint32_t TREE_SALT = 0x5851f42d;
+
+static_assert(Chunk::SIZE % 8 == 0 && (1 << MIN_SHIFT) % 8 == 0, 
+        "8 lanes of a row must share a lattice cell");
+static_assert(POCKET_SHIFT - (NUM_OCTAVES - 1) >= MIN_SHIFT && GROUND_SHIFT <= MAX_SHIFT,
+        "octaves out of the weight table");
+
+//smoothstep interpolation weights for every offset within a lattice cell, in 1/128ths;
+//kept in 16 bits, so (b - a) * w never overflows for 8-bit lattice values
+struct SmoothTable {
+    int16_t weights[MAX_SHIFT + 1][1 << MAX_SHIFT];
+
+    SmoothTable() {
+        for (int s = MIN_SHIFT; s <= MAX_SHIFT; ++s) {
+            int64_t n = int64_t(1) << s;
+            for (int64_t f = 0; f < n; ++f)
+                weights[s][f] = static_cast<int16_t>(128 * f * f * (3 * n - 2 * f) / (n * n * n));
+        }
+    }
+};
+
+const SmoothTable SMOOTH;
+
+static uint32_t hash_cell(uint32_t seed, int x, int y) {
+    uint32_t h = seed ^ (uint32_t(x) * 0x27d4eb2du) ^ (uint32_t(y) * 0x165667b1u);
+    h ^= h >> 15;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static int16_t lattice(uint32_t seed, int x, int y) {
+    return static_cast<int16_t>(hash_cell(seed, x, y) & 0xFF);
+}
+
+TerrainGenerator::TerrainGenerator(uint32_t seed, size_t num_threads)
+    : m_seed(seed), m_job_x(0), m_job_y(0), m_job_blk(nullptr), m_next(0), m_job(0), 
+      m_working(0), m_stop(false)
+{
+    //more threads than chunks would have nothing to do
+    num_threads = std::min<size_t>(num_threads, Block::N * Block::N);
+    for (size_t i = 1; i < num_threads; ++i)
+        m_helpers.emplace_back(&TerrainGenerator::helper_routine, this);
+}
+
+TerrainGenerator::~TerrainGenerator() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto &t: m_helpers)
+        t.join();
+}
+
+void TerrainGenerator::noise_row(uint32_t seed, int shift, int x, int y, int16_t *out) {
+    std::fill(out, out + Chunk::SIZE, 0);
+    for (int k = 0; k < NUM_OCTAVES; ++k, --shift, seed += GROUND_SALT) {
+        const int mask = (1 << shift) - 1;
+        const int16_t *w = SMOOTH.weights[shift];
+        const int iy = y >> shift;
+        const int16_t ty = w[y & mask];
+        int last_ix = -1;
+        int16_t a = 0, b = 0, c = 0, d = 0;
+        for (size_t i = 0; i < Chunk::SIZE; i += 8) {
+            int xx = x + static_cast<int>(i), ix = xx >> shift, fx = xx & mask;
+            //the corners only change once per lattice cell
+            if (ix != last_ix) {
+                a = lattice(seed, ix, iy);
+                b = lattice(seed, ix + 1, iy);
+                c = lattice(seed, ix, iy + 1);
+                d = lattice(seed, ix + 1, iy + 1);
+                last_ix = ix;
+            }
+#ifdef TERRAIN_SSE2
+            //bilinear with smoothstep weights, 8 cells at once
+            __m128i tx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + fx));
+            __m128i va = _mm_set1_epi16(a), vc = _mm_set1_epi16(c);
+            __m128i top = _mm_add_epi16(va, _mm_srai_epi16(
+                        _mm_mullo_epi16(_mm_set1_epi16(int16_t(b - a)), tx), 7));
+            __m128i bot = _mm_add_epi16(vc, _mm_srai_epi16(
+                        _mm_mullo_epi16(_mm_set1_epi16(int16_t(d - c)), tx), 7));
+            __m128i v = _mm_add_epi16(top, _mm_srai_epi16(
+                        _mm_mullo_epi16(_mm_sub_epi16(bot, top), _mm_set1_epi16(ty)), 7));
+            __m128i *dst = reinterpret_cast<__m128i*>(out + i);
+            _mm_storeu_si128(dst, _mm_add_epi16(_mm_loadu_si128(dst), _mm_srai_epi16(v, k)));
+#else
+            for (int l = 0; l < 8; ++l) {
+                int16_t tx = w[fx + l];
+                int16_t top = int16_t(a + (((b - a) * tx) >> 7)), 
+                    bot = int16_t(c + (((d - c) * tx) >> 7));
+                out[i + l] = int16_t(out[i + l] + ((top + (((bot - top) * ty) >> 7)) >> k));
+            }
+#endif
+        }
+    }
+}
+
+int TerrainGenerator::trunk_height(int x) const {
+    uint32_t h = hash_cell(m_seed ^ TREE_SALT, x >> TREE_SLOT_SHIFT, 0);
+    //two columns wide, in the middle of the slot
+    int pos = x & ((1 << TREE_SLOT_SHIFT) - 1);
+    if (h % TREE_RARITY || pos < 7 || pos > 8)
+        return 0;
+    return TREE_MIN_HEIGHT + static_cast<int>((h >> 8) % (TREE_MAX_HEIGHT - TREE_MIN_HEIGHT));
+}
+
+void TerrainGenerator::generate_chunk(size_t ch_x, size_t ch_y, Chunk &ch) const {
+    const int x0 = static_cast<int>(ch_x * Chunk::SIZE), y0 = static_cast<int>(ch_y * Chunk::SIZE);
+
+    int16_t heights[Chunk::SIZE], trunks[Chunk::SIZE], caves[Chunk::SIZE], pockets[Chunk::SIZE];
+    noise_row(m_seed ^ GROUND_SALT, GROUND_SHIFT, x0, 0, heights);
+    int min_height = INT16_MAX;
+    for (size_t i = 0; i < Chunk::SIZE; ++i) {
+        heights[i] = int16_t(GROUND_LEVEL - GROUND_AMPLITUDE 
+                + heights[i] * 2 * GROUND_AMPLITUDE / NOISE_MAX);
+        min_height = std::min<int>(min_height, heights[i]);
+        //no trees under the water
+        trunks[i] = heights[i] < WATER_LEVEL ? int16_t(trunk_height(x0 + int(i))) : 0;
+    }
+
+    const Particle none = Particle::create<None>(), sand = Particle::create<Sand>(),
+          water = Particle::create<Water>(), wood = Particle::create<Wood>();
+    for (size_t j = 0; j < Chunk::SIZE; ++j) {
+        const int y = y0 + static_cast<int>(j);
+        //the noise is only needed below the surface
+        if (y >= min_height) {
+            noise_row(m_seed ^ CAVE_SALT, CAVE_SHIFT, x0, y, caves);
+            noise_row(m_seed ^ POCKET_SALT, POCKET_SHIFT, x0, y, pockets);
+        }
+        Particle *row = ch.data[j];
+        for (size_t i = 0; i < Chunk::SIZE; ++i) {
+            const int h = heights[i];
+            if (y < h) {
+                if (y >= WATER_LEVEL)
+                    row[i] = water;
+                else 
+                    row[i] = y >= h - trunks[i] ? wood : none;
+                continue;
+            }
+            const int depth = y - h;
+            if (depth >= CAVE_MIN_DEPTH && caves[i] > CAVE_THRESHOLD)
+                row[i] = none;
+            else if (depth < SOIL_DEPTH || pockets[i] > POCKET_THRESHOLD)
+                row[i] = sand;
+            else
+                row[i] = wood;
+        }
+    }
+
+    ch.cur_dirty_rect.reset();
+    ch.next_dirty_rect.reset();
+    for (auto &r: ch.needs_redrawing)
+        r.reset();
+    ch.detect_uniform();
+    if (!ch.is_uniform)
+        ch.next_dirty_rect = chunk_bounds(static_cast<int>(ch_x), static_cast<int>(ch_y));
+}
+
+void TerrainGenerator::generate(size_t blk_x, size_t blk_y, Block &blk) const {
+    std::lock_guard<std::mutex> block_lock(m_block_mtx);
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_job_x = blk_x;
+        m_job_y = blk_y;
+        m_job_blk = &blk;
+        m_next = 0;
+        m_working = m_helpers.size();
+        ++m_job;
+    }
+    m_cv.notify_all();
+    work();
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_done.wait(lock, [this]() { return m_working == 0; });
+    m_job_blk = nullptr;
+}
+
+void TerrainGenerator::work() const {
+    const size_t n = Block::N * Block::N;
+    for (size_t k; (k = m_next++) < n;) {
+        size_t i = k % Block::N, j = k / Block::N;
+        generate_chunk(m_job_x * Block::N + i, m_job_y * Block::N + j, m_job_blk->chunks[j][i]);
+    }
+}
+
+void TerrainGenerator::helper_routine() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(m_mtx);
+    while (true) {
+        m_cv.wait(lock, [&]() { return m_stop || m_job != seen; });
+        if (m_stop)
+            return;
+        seen = m_job;
+        lock.unlock();
+        work();
+        lock.lock();
+        if (--m_working == 0)
+            m_done.notify_one();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef TERRAIN_HPP
+#define TERRAIN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+struct Block;
+struct Chunk;
+
+//Deterministic terrain for the blocks that have never been stored:
+//a rolling wooden ground covered with sand, sand pockets and caves underneath,
+//lakes in the dips and the odd tree trunk.
+//The same seed always gives the same world, whatever the order the blocks get generated in.
+//Can be shared between threads, the blocks get generated one at a time.
+class TerrainGenerator {
+public:
+    //the ground level wanders around this height (in particles from the top of the world)
+    static const int GROUND_LEVEL = 320;
+    //the dips below this get filled with water
+    static const int WATER_LEVEL = 360;
+
+    //starts num_threads - 1 helper threads, which wait for generate() in between the blocks
+    explicit TerrainGenerator(uint32_t seed, size_t num_threads = 1);
+    ~TerrainGenerator();
+
+    uint32_t seed() const { return m_seed; }
+
+    //the chunks get split between num_threads threads, the calling one included;
+    //the non-uniform chunks are left dirty, so whatever isn't resting settles down
+    void generate(size_t blk_x, size_t blk_y, Block &blk) const;
+    void generate_chunk(size_t ch_x, size_t ch_y, Chunk &ch) const;
+
+private:
+    uint32_t m_seed;
+
+    std::vector<std::thread> m_helpers;
+    //generate() holds it for the whole block
+    mutable std::mutex m_block_mtx;
+    //the block being generated, handed out a chunk at a time
+    mutable std::mutex m_mtx;
+    mutable std::condition_variable m_cv, m_done;
+    mutable size_t m_job_x, m_job_y;
+    mutable Block *m_job_blk;
+    mutable std::atomic<size_t> m_next;
+    //bumped for every block, so the helpers can tell a new one
+    mutable uint64_t m_job;
+    //helpers that haven't finished the current block
+    mutable size_t m_working;
+    bool m_stop;
+
+    void helper_routine();
+    void work() const;
+
+    //three octaves of value noise for a row of Chunk::SIZE cells starting at x (aligned to 8),
+    //the coarsest octave has cells of 2^shift particles; in 0..NOISE_MAX
+    static void noise_row(uint32_t seed, int shift, int x, int y, int16_t *out);
+    //trunk height for the column, 0 if there's no tree
+    int trunk_height(int x) const;
+};
+
+#endif
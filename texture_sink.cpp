@@ -0,0 +1,18 @@
+#include "texture_sink.hpp"
+#include <cstdio>
+
+void TextureSink::create(int width, int height) {
+    if (!m_texture.create(width, height)) {
+        printf("FAILED TO CREATE TEXTURE\n");
+    }
+}
+
+void TextureSink::update(const Color *pixels, int y, int yy) {
+    int width = m_texture.getSize().x;
+    int height = yy - y + 1;
+    m_texture.update((const sf::Uint8*)pixels, width, height, 0, y);
+}
+
+const sf::Texture& TextureSink::get_texture() const {
+    return m_texture;
+}
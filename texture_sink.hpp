@@ -0,0 +1,19 @@
+#ifndef TEXTURE_SINK_HPP
+#define TEXTURE_SINK_HPP
+
+#include <SFML/Graphics/Texture.hpp>
+#include "pixel_sink.hpp"
+
+//uploads the pixels to an sf::Texture, requires a GL context
+class TextureSink : public PixelSink {
+public:
+    void create(int width, int height) override;
+    void update(const Color *pixels, int y, int yy) override;
+
+    const sf::Texture& get_texture() const;
+
+private:
+    sf::Texture m_texture;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "trace.hpp"
+#include <cstdio>
+
+Tracer::Tracer(size_t num_threads)
+    : m_start(Clock::now()), m_rings(num_threads), m_enabled(false) {}
+
+size_t Tracer::memory_bytes() const {
+    size_t res = m_rings.capacity() * sizeof(Ring);
+    for (auto &ring: m_rings)
+        res += ring.events.capacity() * sizeof(TraceEvent);
+    return res;
+}
+
+void Tracer::set_enabled(bool enabled) {
+    m_enabled = enabled;
+    if (!enabled)
+        return;
+    for (auto &ring: m_rings)
+        ring.events.resize(CAPACITY);
+}
+
+void Tracer::clear() {
+    for (auto &ring: m_rings)
+        ring.count = 0;
+}
+
+bool Tracer::write_chrome_json(const std::string &path) const {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        printf("FAILED TO OPEN %s\n", path.c_str());
+        return false;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    const char *sep = "";
+    for (size_t tid = 0; tid < m_rings.size(); ++tid) {
+        bool is_caller = tid + 1 == m_rings.size();
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%zu,"
+                "\"args\":{\"name\":\"%s %zu\"}}", sep, tid, is_caller ? "scheduler" : "worker", tid);
+        sep = ",\n";
+
+        const Ring &ring = m_rings[tid];
+        uint64_t first = ring.count > CAPACITY ? ring.count - CAPACITY : 0;
+        for (uint64_t i = first; i < ring.count; ++i) {
+            const TraceEvent &e = ring.events[i % CAPACITY];
+            //timestamps are in microseconds
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%zu,"
+                    "\"ts\":%.3f,\"dur\":%.3f", e.name, e.category, tid,
+                    e.begin / 1e3, (e.end - e.begin) / 1e3);
+            if (e.x >= 0 || e.updated >= 0) {
+                fprintf(out, ",\"args\":{");
+                if (e.x >= 0)
+                    fprintf(out, "\"x\":%d,\"y\":%d%s", e.x, e.y, e.updated >= 0 ? "," : "");
+                if (e.updated >= 0)
+                    fprintf(out, "\"updated\":%d,\"tested\":%d", e.updated, e.tested);
+                fprintf(out, "}");
+            }
+            fprintf(out, "}");
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    bool ok = !ferror(out);
+    fclose(out);
+    if (!ok)
+        printf("FAILED TO WRITE %s\n", path.c_str());
+    return ok;
+}
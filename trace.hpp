@@ -0,0 +1,67 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+//a span of time on one thread; the names must be string literals
+struct TraceEvent {
+    const char *name;
+    //phase, group, chunk, block or wait
+    const char *category;
+    //nanoseconds since the tracer was created
+    uint64_t begin, end;
+    //chunk or block coordinates, -1 if there are none
+    int32_t x, y;
+    //particles updated / tested, -1 if not counted
+    int32_t updated, tested;
+};
+
+//Collects the events of the scheduler threads, each into its own ring
+//(so the threads never contend), and writes them out in the Chrome trace_event format
+//for chrome://tracing or ui.perfetto.dev.
+//Once the rings are full, the oldest events get overwritten.
+//Only enable / disable / write / clear it while none of the threads is recording.
+class Tracer {
+public:
+    //events kept per thread
+    static const size_t CAPACITY = 1 << 15;
+
+    //the last thread is the one running the scheduler
+    explicit Tracer(size_t num_threads);
+
+    //the rings get allocated on first use, a disabled tracer holds no memory
+    void set_enabled(bool enabled);
+    bool enabled() const { return m_enabled; }
+    //the rings, in bytes
+    size_t memory_bytes() const;
+
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count();
+    }
+
+    void record(size_t thread, const TraceEvent &e) {
+        Ring &ring = m_rings[thread];
+        ring.events[ring.count++ % CAPACITY] = e;
+    }
+
+    void clear();
+    bool write_chrome_json(const std::string &path) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Ring {
+        std::vector<TraceEvent> events;
+        //all the events recorded so far, the ring holds the last CAPACITY of them
+        uint64_t count = 0;
+    };
+
+    Clock::time_point m_start;
+    std::vector<Ring> m_rings;
+    bool m_enabled;
+};
+
+#endif
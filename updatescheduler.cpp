@@ -1,13 +1,15 @@
 #include "updatescheduler.hpp"
 #include <functional>
 #include <numeric>
+#include <algorithm>
+#include <chrono>
 #include "simulation.hpp"
 
 namespace scheduler {
 namespace detail {
 
 Queue::Queue() 
-    : m_pointer(0) {}
+    : m_pointer(0), m_reversed(false) {}
 
 void Queue::push(const ChunkForUpdating &cfu) {
     std::lock_guard<std::mutex> lock(m_mtx);
@@ -18,7 +20,8 @@ bool Queue::pop(ChunkForUpdating &cfu) {
     std::lock_guard<std::mutex> lock(m_mtx);
     if (m_pointer >= m_data.size())
         return false;
-    cfu = m_data[m_pointer++];
+    size_t idx = m_pointer++;
+    cfu = m_data[m_reversed ? m_data.size() - 1 - idx : idx];
     return true;
 }
 
@@ -27,6 +30,21 @@ void Queue::reset() {
     m_pointer = 0;
 }
 
+bool Queue::empty() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_data.empty();
+}
+
+void Queue::set_reversed(bool reversed) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_reversed = reversed;
+}
+
+size_t Queue::memory_bytes() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_data.capacity() * sizeof(ChunkForUpdating);
+}
+
 void Queue::clear() {
     std::lock_guard<std::mutex> lock(m_mtx);
     m_pointer = 0;
@@ -35,11 +53,17 @@ void Queue::clear() {
 
 } //detail
 
+const char *MODE_NAMES[] = { "propagate", "prepare", "update", "render", "hash", "edit" };
+const char *GROUP_NAMES[] = { "group 0", "group 1", "group 2", "group 3" };
+
 inline size_t group_idx(size_t ch_x, size_t ch_y) {
     return 2 * (ch_y % 2) + ch_x % 2;
 }
 
-UpdateScheduler::UpdateScheduler(Simulation &sim, size_t num_threads) : m_sim(sim) {
+UpdateScheduler::UpdateScheduler(Simulation &sim, size_t num_threads) 
+    : m_sim(sim), m_tracer(num_threads + 1), m_tracing(false), m_run_start(0), m_num_groups(0), m_counting(false),
+      m_costing(false)
+{
     m_active_group = 0;
     m_status = detail::Paused;
     m_busy = num_threads;
@@ -47,6 +71,12 @@ UpdateScheduler::UpdateScheduler(Simulation &sim, size_t num_threads) : m_sim(si
     m_threads.reserve(num_threads);
     m_load_balance.resize(num_threads + 1);
     m_stats.resize(num_threads + 1, 0);
+    m_counters.resize(num_threads + 1);
+    m_finished.resize(num_threads + 1, Finished{0, 0, 0, false});
+    m_busy_hists.reset(new Histogram[num_threads + 1]);
+    m_busy_time.resize(num_threads + 1, std::chrono::nanoseconds(0));
+    for (auto &perf: m_perf)
+        perf.resize(num_threads + 1);
     for (size_t i = 0; i < num_threads; ++i) {
         m_threads.emplace_back(std::bind(
                     &UpdateScheduler::thread_routine, this, i));
@@ -62,6 +92,12 @@ void UpdateScheduler::push_chunk(size_t ch_x, size_t ch_y, Chunk *ch) {
         m_cv.notify_one();
 }
 
+void UpdateScheduler::push_block(size_t blk_x, size_t blk_y) {
+    m_groups[0].push(detail::ChunkForUpdating{blk_x, blk_y, nullptr});
+    if (m_active_group == 0)
+        m_cv.notify_one();
+}
+
 void UpdateScheduler::clear() {
     for (auto &g: m_groups)
         g.clear();
@@ -69,35 +105,111 @@ void UpdateScheduler::clear() {
 
 void UpdateScheduler::run(Mode mode) {
     std::fill(m_stats.begin(), m_stats.end(), 0);
+    size_t caller = m_threads.size();
+    m_tracing = m_tracer.enabled();
+    m_run_start = m_tracing ? m_tracer.now() : 0;
+    bool any = false;
 
     for (size_t i = 0; i < 4; ++i) {
+        //no point in waking up the workers
+        if (m_groups[i].empty())
+            continue;
+        any = true;
         std::unique_lock<std::mutex> lock(m_mtx);
         m_groups[i].reset();
         m_active_group = i;
         m_mode = mode;
+        ++m_num_groups;
+        for (auto &f: m_finished)
+            f.any = false;
+        uint64_t group_start = m_tracing ? m_tracer.now() : 0;
         lock.unlock();
 
         m_status = detail::Working;
         m_cv.notify_all();
 
-        process_chunks(m_threads.size());
+        process_measured(caller);
         m_status = detail::Paused;
 
+        uint64_t wait_start = m_tracing ? m_tracer.now() : 0;
         lock.lock();
         m_done.wait(lock, [this]() { return m_busy == 0; });
+        if (m_costing && mode == Update) {
+            auto last = std::max_element(m_finished.begin(), m_finished.end(), 
+                    [](const Finished &lhs, const Finished &rhs) { 
+                        return lhs.any < rhs.any || (lhs.any == rhs.any && lhs.end < rhs.end); 
+                    });
+            if (last->any)
+                m_sim.record_straggler(last->ch_x, last->ch_y);
+        }
+        if (m_tracing) {
+            trace(caller, "barrier", "wait", wait_start);
+            trace(caller, GROUP_NAMES[i], "group", group_start);
+        }
     }
+    if (m_tracing)
+        trace(caller, MODE_NAMES[mode], "phase", m_run_start);
 
     if (mode == Update) {
         uint64_t n = std::max(1, std::accumulate(m_stats.begin(), m_stats.end(), 0));
         for (size_t i = 0; i < m_threads.size() + 1; ++i)
             m_load_balance[i].push(static_cast<float>(m_stats[i]) / n);
+        //nothing to do at all doesn't count either
+        if (any) {
+            for (size_t i = 0; i < m_threads.size() + 1; ++i)
+                m_busy_hists[i].record(std::chrono::duration_cast<std::chrono::microseconds>(m_busy_time[i]).count());
+        }
+        std::fill(m_busy_time.begin(), m_busy_time.end(), std::chrono::nanoseconds(0));
     }
 }
 
+void UpdateScheduler::set_reversed(bool reversed) {
+    for (auto &g: m_groups)
+        g.set_reversed(reversed);
+}
+
+size_t UpdateScheduler::memory_bytes() {
+    size_t n = m_threads.size() + 1;
+    size_t res = m_tracer.memory_bytes();
+    for (auto &g: m_groups)
+        res += g.memory_bytes();
+    res += m_threads.capacity() * sizeof(std::thread);
+    res += m_stats.capacity() * sizeof(uint64_t) + m_load_balance.capacity() * sizeof(LoadTracker);
+    res += n * sizeof(Histogram) + m_busy_time.capacity() * sizeof(std::chrono::nanoseconds);
+    res += m_counters.capacity() * sizeof(std::unique_ptr<PerfCounters>);
+    for (auto &c: m_counters)
+        res += c ? sizeof(PerfCounters) : 0;
+    for (auto &perf: m_perf)
+        res += perf.capacity() * sizeof(PerfSample);
+    res += m_finished.capacity() * sizeof(Finished);
+    return res;
+}
+
 const std::vector<LoadTracker>& UpdateScheduler::load_balance() const {
     return m_load_balance;
 }
 
+void UpdateScheduler::set_perf_counting(bool enabled) {
+    if (enabled && !m_counting) {
+        for (auto &perf: m_perf)
+            std::fill(perf.begin(), perf.end(), PerfSample());
+    }
+    m_counting = enabled;
+}
+
+const Histogram& UpdateScheduler::busy_histogram(size_t thread) const {
+    return m_busy_hists[thread];
+}
+
+void UpdateScheduler::reset_histograms() {
+    for (size_t i = 0; i < m_threads.size() + 1; ++i)
+        m_busy_hists[i].reset();
+}
+
+const PerfSample& UpdateScheduler::perf_totals(size_t thread, Mode mode) const {
+    return m_perf[mode][thread];
+}
+
 UpdateScheduler::~UpdateScheduler() {
     m_status = detail::Stopped;
     m_cv.notify_all();
@@ -106,6 +218,11 @@ UpdateScheduler::~UpdateScheduler() {
 }
 
 void UpdateScheduler::thread_routine(size_t worker_idx) {
+    //when the worker ran out of chunks last time, if that was traced
+    uint64_t idle_since = 0;
+    bool was_tracing = false;
+    //the workers keep coming back until the group is over, one idle span per group is enough
+    uint64_t seen_group = 0;
     while (true) {
         {
             std::unique_lock<std::mutex> lock(m_mtx);
@@ -118,46 +235,155 @@ void UpdateScheduler::thread_routine(size_t worker_idx) {
         if (m_status == detail::Stopped)
             break;
 
-        process_chunks(worker_idx);
+        //from the last chunk to the next group: the group barriers and the wake-up latency,
+        //the time between the runs doesn't count
+        if (m_num_groups != seen_group) {
+            seen_group = m_num_groups;
+            if (m_tracing && was_tracing)
+                trace(worker_idx, "idle", "wait", std::max(idle_since, m_run_start));
+        }
+        if (process_measured(worker_idx)) {
+            was_tracing = m_tracing;
+            if (was_tracing)
+                idle_since = m_tracer.now();
+        }
     }
 }
 
-void UpdateScheduler::process_chunks(size_t worker_idx) {
+size_t UpdateScheduler::process_chunks(size_t worker_idx) {
     switch (m_mode) {
+    case Propagate:
+        return propagate(worker_idx);
     case Prepare:
-        prepare(worker_idx);
-        break;
+        return prepare(worker_idx);
     case Update:
-        update(worker_idx);
-        break;
+        return update(worker_idx);
     case Render:
-        render(worker_idx);
-        break;
+        return render(worker_idx);
+    case Hash:
+        return hash(worker_idx);
+    case ApplyEdits:
+        return apply_edits(worker_idx);
     default:
         //unreachable
-        break;
+        return 0;
     };
 }
 
-void UpdateScheduler::prepare(size_t worker_idx) {
+size_t UpdateScheduler::process_measured(size_t worker_idx) {
+    using Clock = std::chrono::steady_clock;
+    bool timed = m_mode == Update;
+    auto t = timed ? Clock::now() : Clock::time_point();
+    size_t n;
+    if (m_counting) {
+        auto &counters = m_counters[worker_idx];
+        if (!counters)
+            counters.reset(new PerfCounters());
+        PerfSample before = counters->read();
+        n = process_chunks(worker_idx);
+        m_perf[m_mode][worker_idx] += counters->read() - before;
+    } else {
+        n = process_chunks(worker_idx);
+    }
+    //the passes that found the group empty don't count
+    if (timed && n)
+        m_busy_time[worker_idx] += Clock::now() - t;
+    return n;
+}
+
+size_t UpdateScheduler::propagate(size_t worker_idx) {
     detail::ChunkForUpdating cfu;
-    while (m_groups[m_active_group].pop(cfu)) {
+    size_t n = 0;
+    for (; m_groups[m_active_group].pop(cfu); ++n) {
+        uint64_t t = m_tracing ? m_tracer.now() : 0;
+        m_sim.fit_block(cfu.ch_x, cfu.ch_y, worker_idx);
+        if (m_tracing)
+            trace(worker_idx, "fit", "block", t, cfu.ch_x, cfu.ch_y);
+    }
+    return n;
+}
+
+size_t UpdateScheduler::prepare(size_t worker_idx) {
+    detail::ChunkForUpdating cfu;
+    size_t n = 0;
+    for (; m_groups[m_active_group].pop(cfu); ++n) {
+        uint64_t t = m_tracing ? m_tracer.now() : 0;
         m_sim.prepare_chunk(cfu.ch_x, cfu.ch_y, *cfu.ch, worker_idx);
+        if (m_tracing)
+            trace(worker_idx, "prepare", "chunk", t, cfu.ch_x, cfu.ch_y);
     }
+    return n;
 }
 
-void UpdateScheduler::update(size_t worker_idx) {
+size_t UpdateScheduler::update(size_t worker_idx) {
     detail::ChunkForUpdating cfu;
-    while (m_groups[m_active_group].pop(cfu)) {
+    size_t n = 0;
+    for (; m_groups[m_active_group].pop(cfu); ++n) {
+        if (!m_tracing && !m_costing) {
+            m_sim.update_chunk(cfu.ch_x, cfu.ch_y, *cfu.ch, worker_idx);
+            ++m_stats[worker_idx];
+            continue;
+        }
+        uint64_t t = m_tracer.now();
+        int updated = m_sim.m_updated_particles[worker_idx];
+        int tested = m_sim.m_tested_particles[worker_idx];
         m_sim.update_chunk(cfu.ch_x, cfu.ch_y, *cfu.ch, worker_idx);
         ++m_stats[worker_idx];
+        uint64_t end = m_tracer.now();
+        updated = m_sim.m_updated_particles[worker_idx] - updated;
+        tested = m_sim.m_tested_particles[worker_idx] - tested;
+        if (m_tracing) {
+            m_tracer.record(worker_idx, TraceEvent{ "update", "chunk", t, end, 
+                    static_cast<int>(cfu.ch_x), static_cast<int>(cfu.ch_y), updated, tested });
+        }
+        if (m_costing) {
+            m_sim.record_chunk_cost(cfu.ch_x, cfu.ch_y, end - t, updated, tested);
+            m_finished[worker_idx] = Finished{ end, cfu.ch_x, cfu.ch_y, true };
+        }
     }
+    return n;
 }
 
-void UpdateScheduler::render(size_t worker_idx) {
+size_t UpdateScheduler::render(size_t worker_idx) {
     detail::ChunkForUpdating cfu;
-    while (m_groups[m_active_group].pop(cfu))
+    size_t n = 0;
+    for (; m_groups[m_active_group].pop(cfu); ++n) {
+        uint64_t t = m_tracing ? m_tracer.now() : 0;
         m_sim.render_chunk(cfu.ch_x, cfu.ch_y, *cfu.ch, worker_idx);
+        if (m_tracing)
+            trace(worker_idx, "render", "chunk", t, cfu.ch_x, cfu.ch_y);
+    }
+    return n;
+}
+
+size_t UpdateScheduler::hash(size_t worker_idx) {
+    detail::ChunkForUpdating cfu;
+    size_t n = 0;
+    for (; m_groups[m_active_group].pop(cfu); ++n) {
+        uint64_t t = m_tracing ? m_tracer.now() : 0;
+        m_sim.hash_chunk(cfu.ch_x, cfu.ch_y, worker_idx);
+        if (m_tracing)
+            trace(worker_idx, "hash", "chunk", t, cfu.ch_x, cfu.ch_y);
+    }
+    return n;
+}
+
+size_t UpdateScheduler::apply_edits(size_t worker_idx) {
+    detail::ChunkForUpdating cfu;
+    size_t n = 0;
+    for (; m_groups[m_active_group].pop(cfu); ++n) {
+        uint64_t t = m_tracing ? m_tracer.now() : 0;
+        m_sim.edit_chunk(cfu.ch_x, cfu.ch_y, *cfu.ch, worker_idx);
+        if (m_tracing)
+            trace(worker_idx, "edit", "chunk", t, cfu.ch_x, cfu.ch_y);
+    }
+    return n;
+}
+
+void UpdateScheduler::trace(size_t worker_idx, const char *name, const char *category, 
+        uint64_t begin, int x, int y, int updated, int tested) {
+    m_tracer.record(worker_idx, TraceEvent{ name, category, begin, m_tracer.now(), 
+            x, y, updated, tested });
 }
 
 
@@ -6,7 +6,12 @@
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
+#include <memory>
+#include <chrono>
 #include "avgtracker.hpp"
+#include "histogram.hpp"
+#include "trace.hpp"
+#include "perf_counters.hpp"
 
 struct Chunk;
 class Simulation;
@@ -15,6 +20,7 @@ namespace scheduler {
 
 namespace detail {
 
+//when propagating, it holds the block coordinates and no chunk
 struct ChunkForUpdating {
     size_t ch_x, ch_y;
     Chunk *ch;
@@ -29,10 +35,15 @@ public:
 
     void reset();
     void clear();
+    bool empty();
+    //hands the chunks out last to first
+    void set_reversed(bool reversed);
+    size_t memory_bytes();
 
 private:
     std::vector<ChunkForUpdating> m_data;
     size_t m_pointer;
+    bool m_reversed;
     std::mutex m_mtx;
 };
 
@@ -46,9 +57,16 @@ enum State {
 } //detail
 
 enum Mode {
+    //whole blocks rather than chunks, see push_block()
+    Propagate,
     Prepare,
     Update,
-    Render
+    Render,
+    //refreshing the content hashes of the chunks that might have changed
+    Hash,
+    //writing the queued edits into the chunks they cover
+    ApplyEdits,
+    NUM_MODES
 };
 
 using LoadTracker = AvgTracker<float, 64>;
@@ -60,22 +78,61 @@ public:
             size_t num_threads = std::thread::hardware_concurrency() - 1);
 
     void push_chunk(size_t ch_x, size_t ch_y, Chunk *ch);
+    //the blocks only write into themselves when propagating, so they all share a group
+    void push_block(size_t blk_x, size_t blk_y);
     void clear();
 
     void run(Mode mode);
 
+    //the order of the chunks within each group, the outcome mustn't depend on it;
+    //only call it between the runs
+    void set_reversed(bool reversed);
+
     const std::vector<LoadTracker>& load_balance() const;
+    //how long each thread spent on its chunks in the update runs that had any, in microseconds;
+    //the last thread is the calling one
+    const Histogram& busy_histogram(size_t thread) const;
+    void reset_histograms();
+
+    //the phases, the groups, every chunk and the waits at the barriers;
+    //only touch it between the runs
+    Tracer& tracer() { return m_tracer; }
+    const Tracer& tracer() const { return m_tracer; }
+
+    //samples the hardware counters of every thread around its share of each run,
+    //the totals start over every time it gets enabled; only call it between the runs
+    void set_perf_counting(bool enabled);
+    bool is_perf_counting() const { return m_counting; }
+    //the last thread is the calling one
+    const PerfSample& perf_totals(size_t thread, Mode mode) const;
+    size_t num_threads() const { return m_threads.size(); }
+    //the queues, the per-thread statistics and the trace, in bytes; only call it between the runs
+    size_t memory_bytes();
+
+    //times every chunk in the update runs and hands the costs to the simulation,
+    //along with the chunk of each group that finished last; only call it between the runs
+    void set_cost_tracking(bool enabled) { m_costing = enabled; }
+    bool is_cost_tracking() const { return m_costing; }
 
     ~UpdateScheduler();
 
 private:
     void thread_routine(size_t worker_idx);
 
-    void process_chunks(size_t worker_idx);
+    //return how many chunks (or blocks) the worker got through
+    size_t process_chunks(size_t worker_idx);
+    //with the hardware counters and the busy time
+    size_t process_measured(size_t worker_idx);
+
+    size_t propagate(size_t worker_idx);
+    size_t prepare(size_t worker_idx);
+    size_t update(size_t worker_idx);
+    size_t render(size_t worker_idx);
+    size_t hash(size_t worker_idx);
+    size_t apply_edits(size_t worker_idx);
 
-    void prepare(size_t worker_idx);
-    void update(size_t worker_idx);
-    void render(size_t worker_idx);
+    void trace(size_t worker_idx, const char *name, const char *category, uint64_t begin,
+            int x = -1, int y = -1, int updated = -1, int tested = -1);
 
     Simulation &m_sim;
     //each queue contains a group of independent chunks that can be updated in parallel
@@ -91,6 +148,31 @@ private:
 
     std::vector<uint64_t> m_stats;
     std::vector<LoadTracker> m_load_balance;
+    //each thread adds to its own time, the calling one records them once the run is over
+    std::unique_ptr<Histogram[]> m_busy_hists;
+    std::vector<std::chrono::nanoseconds> m_busy_time;
+
+    Tracer m_tracer;
+    //whether the current run gets traced, so the workers don't have to ask the tracer
+    bool m_tracing;
+    uint64_t m_run_start;
+    //groups started so far
+    uint64_t m_num_groups;
+
+    bool m_counting;
+    //each thread opens its own when it first gets to count
+    std::vector<std::unique_ptr<PerfCounters>> m_counters;
+    std::vector<PerfSample> m_perf[NUM_MODES];
+
+    struct Finished {
+        //nanoseconds on the tracer's clock
+        uint64_t end;
+        size_t ch_x, ch_y;
+        bool any;
+    };
+    bool m_costing;
+    //the last chunk each thread finished in the current group
+    std::vector<Finished> m_finished;
 };
 
 } //scheduler
@@ -1,6 +1,14 @@
 #include "world.hpp"
+#include "region_store.hpp"
+#include "block_io.hpp"
 #include <memory>
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <iterator>
 #include <type_traits>
 
 
@@ -12,65 +20,55 @@ const Particle& Chunk::get(size_t x, size_t y) const {
     return data[y % SIZE][x % SIZE];
 }
 
-//make slotmap bounds
-Rect<size_t> mksl_bounds(size_t left, size_t top) {
-    return { left, top, left + World::NUM_BLOCKS - 1, 
-        top + World::NUM_BLOCKS - 1};
+void Chunk::detect_uniform() {
+    ParticleType tp = data[0][0].type();
+    is_uniform = false;
+    if (tp == ParticleType::Fire)
+        return;
+    for (auto &row: data)
+        for (auto &p: row)
+            if (p.type() != tp)
+                return;
+    is_uniform = true;
+    uniform = data[0][0];
 }
 
+//the blocks loaded right away, they cover the initial view
+const size_t INITIAL_WIDTH = 2;
+const size_t INITIAL_HEIGHT = 1;
 
-//saturated substraction
-template<typename T>
-T sat_sub(T x, T y) {
-    static_assert(std::is_unsigned<T>::value, "must be unsigned");
-    T res = x - y;
-    res &= -(res <= x);
-    return res;
-}
+static_assert((World::RING_SIZE & (World::RING_SIZE - 1)) == 0, "ring size must be a power of two");
+static_assert(INITIAL_WIDTH * INITIAL_HEIGHT <= World::NUM_BLOCKS, "too many initial blocks");
 
-constexpr size_t my_sqrt(size_t n) {
-    if (!n)
-        return 0;
-    size_t x = 1, xx = 1;
-    do {
-        x = xx;
-        xx = (x * x + n) / (2 * x);
-    } while (x != xx);
-    return x;
-}
-
-const size_t INITIAL_HEIGHT = my_sqrt(World::NUM_BLOCKS);
-const size_t INITIAL_WIDTH = World::NUM_BLOCKS / INITIAL_HEIGHT;
-const Rect<int> WORLD_BOUNDS(0, 0, INITIAL_WIDTH * Block::SIZE - 1, 
-        INITIAL_HEIGHT * Block::SIZE - 1);
-
-World::World() {
-    static_assert(NUM_BLOCKS == INITIAL_WIDTH * INITIAL_HEIGHT);
-
-    m_left = 0;
-    m_top = 0;
-    for (auto &i: m_slotmap)
-        for (auto &j: i)
-            j = NUM_BLOCKS;
-
-    memset(m_blocks, 0, sizeof(m_blocks));
-    for (size_t j = 0; j < INITIAL_HEIGHT; ++j) {
-        for (size_t i = 0; i < INITIAL_WIDTH; ++i) {
-            size_t slot = j * INITIAL_WIDTH + i;
-            m_slotmap[j][i] = static_cast<uint8_t>(slot);
-
-            Block &blk = m_blocks[slot];
-            /* blk.left = i; */
-            /* blk.top = j; */
-            for (auto &i: blk.chunks) {
-                for (auto &j: i) {
-                    j.cur_dirty_rect.reset();
-                    j.next_dirty_rect.reset();
-                    j.needs_redrawing.reset();
-                }
-            }
-        }
+World::World(std::unique_ptr<RegionStore> store, size_t cache_budget,
+        std::unique_ptr<TerrainGenerator> generator) 
+    : m_snapshot_chunks(0), m_generator(std::move(generator)),
+    m_io(store ? new BlockIO(std::move(store), cache_budget, m_generator.get()) : nullptr)
+{
+    for (auto &row: m_ring)
+        for (auto &cell: row)
+            cell.slot = NUM_BLOCKS;
+    for (size_t i = 0; i < NUM_BLOCKS; ++i) {
+        m_blocks[i] = nullptr;
+        m_active[i] = false;
+        m_hash_stale[i] = true;
+        m_free_slots.push_back(NUM_BLOCKS - 1 - i);
     }
+    memset(m_modified, 1, sizeof(m_modified));
+
+    for (size_t j = 0; j < INITIAL_HEIGHT; ++j)
+        for (size_t i = 0; i < INITIAL_WIDTH; ++i)
+            load_block(i, j);
+}
+
+World::~World() {
+    if (!m_io)
+        return;
+    //nothing gets lost on exit, m_io finishes the writes before going away
+    auto f = [this](size_t blk_x, size_t blk_y, Block &blk) { 
+        m_io->store(blk_x, blk_y, blk); 
+    };
+    enumerate_blocks(f);
 }
 
 bool World::is_particle_loaded(size_t x, size_t y) const {
@@ -99,259 +97,586 @@ const Particle& World::get(size_t x, size_t y) const {
     return get_chunk(x / Chunk::SIZE, y / Chunk::SIZE).get(x, y);
 }
 
-void World::fit_dirty_rects(bool keep_old) {
-    auto f = [this, keep_old](size_t i, size_t j, Block &blk) { fit_block(i, j, blk, keep_old); };
-    enumerate_blocks(f);
+void World::fit_block(size_t blk_x, size_t blk_y) {
+    size_t slot = ring_cell(blk_x, blk_y).slot;
+    Block &blk = *m_blocks[slot];
+    size_t off_chx = blk_x * Block::N, off_chy = blk_y * Block::N;
+
+    //the block with the loaded ones around it, the border chunks pull from them as well
+    const Block *around[3][3];
+    for (size_t j = 0; j < 3; ++j)
+        for (size_t i = 0; i < 3; ++i)
+            around[j][i] = is_block_loaded(blk_x + i - 1, blk_y + j - 1) 
+                ? &get_block(blk_x + i - 1, blk_y + j - 1) : nullptr;
+
+    bool any_dirty = false;
+    for (size_t j = 0; j < Block::N; ++j) {
+        for (size_t i = 0; i < Block::N; ++i) {
+            auto &ch = blk.chunks[j][i];
+            Rect<int> bounds = chunk_bounds(off_chx + i, off_chy + j), cur;
+            cur.reset();
+            //the chunk and its 8 neighbours, in the coordinates of the 3x3 blocks
+            for (size_t y = j + Block::N - 1; y <= j + Block::N + 1; ++y) {
+                for (size_t x = i + Block::N - 1; x <= i + Block::N + 1; ++x) {
+                    const Block *nb = around[y / Block::N][x / Block::N];
+                    if (!nb)
+                        continue;
+                    const Rect<int> &next = nb->chunks[y % Block::N][x % Block::N].next_dirty_rect;
+                    if (!next.is_empty() && next.intersects(bounds))
+                        cur.include(next.intersection(bounds));
+                }
+            }
+
+            //not touching the idle chunks keeps their pages shared with the snapshot
+            if (ch.cur_dirty_rect.is_empty() && cur.is_empty())
+                continue;
+            bool was_dirty = ch.is_dirty();
+            ch.cur_dirty_rect = cur;
+            //going idle changes the rect and the uniform state as well
+            m_modified[slot][j][i] = true;
+
+            if (!ch.is_dirty()) {
+                if (was_dirty)
+                    ch.detect_uniform();
+            } else {
+                any_dirty = true;
+                ch.is_uniform = false;
+                for (auto &redraw: ch.needs_redrawing)
+                    redraw.include(cur);
+            }
+        }
+    }
+    //anything that makes it dirty again from now on marks it active
+    m_active[slot].store(any_dirty, std::memory_order_relaxed);
+}
+
+void World::mark_active(size_t blk_x, size_t blk_y) {
+    auto &active = m_active[ring_cell(blk_x, blk_y).slot];
+    //read first, so the workers don't keep bouncing the cache line
+    if (!active.load(std::memory_order_relaxed))
+        active.store(true, std::memory_order_relaxed);
+}
+
+void World::mark_active_around(size_t blk_x, size_t blk_y) {
+    for (size_t j = blk_y - 1; j != blk_y + 2; ++j)
+        for (size_t i = blk_x - 1; i != blk_x + 2; ++i)
+            if (is_block_loaded(i, j))
+                mark_active(i, j);
+}
+
+static uint64_t combine(uint64_t h, uint64_t v) {
+    h ^= v;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 31);
+}
+
+static_assert(sizeof(Particle) % sizeof(uint32_t) == 0, "particles are hashed in 32-bit words");
+
+uint64_t World::hash_chunk(const Chunk &ch) {
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    Particle row[Chunk::SIZE];
+    for (auto &src: ch.data) {
+        memcpy(row, src, sizeof(row));
+        for (auto &p: row)
+            p.set_updated<false>();
+        const size_t WORDS = Chunk::SIZE * sizeof(Particle) / sizeof(uint64_t);
+        uint64_t words[WORDS];
+        memcpy(words, row, sizeof(words));
+        for (auto w: words)
+            h = combine(h, w);
+    }
+    return h;
+}
+
+void World::rehash_chunk(size_t ch_x, size_t ch_y) {
+    size_t slot = ring_cell(ch_x / Block::N, ch_y / Block::N).slot;
+    //the whole block gets hashed once asked for anyway
+    if (m_hash_stale[slot])
+        return;
+    m_chunk_hashes[slot][ch_y % Block::N][ch_x % Block::N] = hash_chunk(get_chunk(ch_x, ch_y));
+}
+
+uint64_t World::chunk_hash(size_t ch_x, size_t ch_y) {
+    size_t blk_x = ch_x / Block::N, blk_y = ch_y / Block::N;
+    block_hash(blk_x, blk_y);
+    return m_chunk_hashes[ring_cell(blk_x, blk_y).slot][ch_y % Block::N][ch_x % Block::N];
+}
+
+uint64_t World::block_hash(size_t blk_x, size_t blk_y) {
+    size_t slot = ring_cell(blk_x, blk_y).slot;
+    const Block &blk = *m_blocks[slot];
+    if (m_hash_stale[slot]) {
+        for (size_t j = 0; j < Block::N; ++j)
+            for (size_t i = 0; i < Block::N; ++i)
+                m_chunk_hashes[slot][j][i] = hash_chunk(blk.chunks[j][i]);
+        m_hash_stale[slot] = false;
+    }
+    uint64_t h = 0;
+    for (auto &row: m_chunk_hashes[slot])
+        for (auto ch: row)
+            h = combine(h, ch);
+    return h;
+}
+
+uint64_t World::world_hash() {
+    uint64_t h = 0;
+    for (auto &i: m_resident) {
+        h = combine(h, (static_cast<uint64_t>(i.blk_y) << 32) | i.blk_x);
+        h = combine(h, block_hash(i.blk_x, i.blk_y));
+    }
+    return h;
+}
+
+uint64_t World::compute_world_hash() const {
+    uint64_t h = 0;
+    for (auto &i: m_resident) {
+        const Block &blk = *m_blocks[i.slot];
+        uint64_t bh = 0;
+        for (auto &row: blk.chunks)
+            for (auto &ch: row)
+                bh = combine(bh, hash_chunk(ch));
+        h = combine(h, (static_cast<uint64_t>(i.blk_y) << 32) | i.blk_x);
+        h = combine(h, bh);
+    }
+    return h;
+}
+
+size_t World::resident_bytes() const {
+    size_t res = sizeof(World);
+    for (auto &blk: m_storage)
+        res += blk ? sizeof(Block) : 0;
+    res += m_resident.capacity() * sizeof(Resident) + m_free_slots.capacity() * sizeof(size_t);
+    res += m_wanted.capacity() * sizeof(std::pair<size_t, size_t>) + m_loaded.capacity() * sizeof(BlockIO::Loaded);
+    return res;
+}
+
+size_t World::cache_bytes() const {
+    return m_io ? m_io->cache_size() : 0;
+}
+
+size_t World::staging_bytes() const {
+    return m_io ? m_io->staging_size() : 0;
+}
+
+void World::invalidate_hashes() {
+    std::fill(std::begin(m_hash_stale), std::end(m_hash_stale), true);
 }
 
 bool World::is_block_loaded(size_t blk_x, size_t blk_y) const {
-    return contains_block(blk_x, blk_y) 
-        && m_slotmap[blk_y - m_top][blk_x - m_left] != NUM_BLOCKS;
+    const Resident &cell = ring_cell(blk_x, blk_y);
+    return cell.slot != NUM_BLOCKS && cell.blk_x == blk_x && cell.blk_y == blk_y;
 }
 
 Block& World::get_block(size_t blk_x, size_t blk_y) {
     assert(is_block_loaded(blk_x, blk_y));
-    return m_blocks[m_slotmap[blk_y - m_top][blk_x - m_left]];
+    return *m_blocks[ring_cell(blk_x, blk_y).slot];
 }
 
 const Block& World::get_block(size_t blk_x, size_t blk_y) const {
     assert(is_block_loaded(blk_x, blk_y));
-    return m_blocks[m_slotmap[blk_y - m_top][blk_x - m_left]];
+    return *m_blocks[ring_cell(blk_x, blk_y).slot];
 }
 
 void World::load_block(size_t blk_x, size_t blk_y) {
+    if (is_block_loaded(blk_x, blk_y))
+        return;
     size_t slot = include_block(blk_x, blk_y);
-    Block &blk = m_blocks[slot];
-    //just reset it
-    memset(&blk, 0, sizeof(blk));
-    /* blk.left = blk_x; */
-    /* blk.top = blk_y; */
+    Block &blk = *m_blocks[slot];
+    mark_modified(slot);
+    if (!m_io || !m_io->load_now(blk_x, blk_y, blk))
+        create_block(blk_x, blk_y, blk);
+    restore_block(blk_x, blk_y, blk);
+}
+
+void World::prefetch(const Rect<int> &view, float vx, float vy) {
+    Rect<int> predicted(view.left + static_cast<int>(vx * PREFETCH_TICKS), 
+            view.top + static_cast<int>(vy * PREFETCH_TICKS),
+            view.right + static_cast<int>(vx * PREFETCH_TICKS),
+            view.bottom + static_cast<int>(vy * PREFETCH_TICKS));
+    int cx = (view.left + view.right) / 2, cy = (view.top + view.bottom) / 2;
+
+    //what's on screen comes first, then where the camera is heading,
+    //and then the neighbours that the activity is about to spill into
+    std::vector<std::pair<int, std::pair<size_t, size_t>>> candidates;
+    auto add_rect = [&](const Rect<int> &r, int priority) {
+        if (r.right < 0 || r.bottom < 0)
+            return;
+        Rect<int> blocks(std::max(r.left, 0) / int(Block::SIZE), std::max(r.top, 0) / int(Block::SIZE),
+                r.right / int(Block::SIZE), r.bottom / int(Block::SIZE));
+        for (int j = blocks.top; j <= blocks.bottom; ++j) {
+            for (int i = blocks.left; i <= blocks.right; ++i) {
+                int dx = i * int(Block::SIZE) + int(Block::SIZE) / 2 - cx,
+                    dy = j * int(Block::SIZE) + int(Block::SIZE) / 2 - cy;
+                candidates.push_back({ priority + abs(dx) + abs(dy), { size_t(i), size_t(j) } });
+            }
+        }
+    };
+    const int PREDICTED = 1 << 20, ACTIVE = 2 << 20;
+    add_rect(view, 0);
+    add_rect(predicted, PREDICTED);
+    auto f = [&](size_t blk_x, size_t blk_y, Block &blk) {
+        Rect<int> r = active_neighbourhood(blk_x, blk_y, blk);
+        if (!r.is_empty())
+            add_rect(r, ACTIVE);
+    };
+    enumerate_active_blocks(f);
+    std::sort(candidates.begin(), candidates.end());
+
+    m_wanted.clear();
+    for (auto &i: candidates) {
+        if (m_wanted.size() >= NUM_BLOCKS)
+            break;
+        if (std::find(m_wanted.begin(), m_wanted.end(), i.second) == m_wanted.end())
+            m_wanted.push_back(i.second);
+    }
+
+    for (auto &i: m_wanted) {
+        if (is_block_loaded(i.first, i.second))
+            continue;
+        if (m_io)
+            m_io->request(i.first, i.second);
+        else 
+            load_block(i.first, i.second);
+    }
+}
+
+void World::poll_io() {
+    if (!m_io)
+        return;
+    m_loaded.clear();
+    m_io->poll(m_loaded);
+    for (auto &i: m_loaded) {
+        bool wanted = std::find(m_wanted.begin(), m_wanted.end(), 
+                std::make_pair(i.blk_x, i.blk_y)) != m_wanted.end();
+        if (!wanted || is_block_loaded(i.blk_x, i.blk_y)) {
+            //it might have been the only copy
+            m_io->discard(i);
+            continue;
+        }
+        size_t slot = include_block(i.blk_x, i.blk_y);
+        Block &blk = *m_blocks[slot];
+        mark_modified(slot);
+        if (i.blk)
+            memcpy(static_cast<void*>(&blk), i.blk, sizeof(Block));
+        else
+            create_block(i.blk_x, i.blk_y, blk);
+        restore_block(i.blk_x, i.blk_y, blk);
+        m_io->release(i.blk);
+    }
+}
+
+Rect<int> World::active_neighbourhood(size_t blk_x, size_t blk_y, const Block &blk) const {
+    Rect<int> r, bounds(blk_x * Block::SIZE, blk_y * Block::SIZE,
+            (blk_x + 1) * Block::SIZE - 1, (blk_y + 1) * Block::SIZE - 1);
+    r.reset();
+    for (size_t j = 0; j < Block::N; ++j) {
+        for (size_t i = 0; i < Block::N; ++i) {
+            if (i && j && i + 1 < Block::N && j + 1 < Block::N)
+                continue;
+            const Chunk &ch = blk.chunks[j][i];
+            if (ch.is_dirty())
+                r.include(ch.cur_dirty_rect);
+        }
+    }
+    if (r.is_empty())
+        return r;
+    //a chunk's worth of margin around the activity at the block border
+    Rect<int> grown(r.left - int(Chunk::SIZE), r.top - int(Chunk::SIZE), 
+            r.right + int(Chunk::SIZE), r.bottom + int(Chunk::SIZE));
+    if (bounds.contains(grown.left, grown.top) && bounds.contains(grown.right, grown.bottom))
+        r.reset();
+    else
+        r = grown;
+    return r;
+}
+
+void World::reset_block(Block &blk) {
+    memset(static_cast<void*>(&blk), 0, sizeof(blk));
     for (auto &i: blk.chunks) {
         for (auto &j: i) {
             j.cur_dirty_rect.reset();
             j.next_dirty_rect.reset();
-            j.needs_redrawing.reset();
+            for (auto &r: j.needs_redrawing)
+                r.reset();
+            j.is_uniform = true;
+            j.uniform = Particle();
         }
     }
 }
 
-
-void World::unload_block(size_t blk_x, size_t blk_y) {
-    //maybe write it to the disk??
+void World::create_block(size_t blk_x, size_t blk_y, Block &blk) {
+    if (m_generator)
+        m_generator->generate(blk_x, blk_y, blk);
+    else
+        reset_block(blk);
 }
 
-bool World::contains_block(size_t blk_x, size_t blk_y) const {
-    return blk_x >= m_left && blk_x < m_left + NUM_BLOCKS
-            && blk_y >= m_top && blk_y < m_top + NUM_BLOCKS;
+void World::mark_modified(size_t slot) {
+    memset(m_modified[slot], 1, sizeof(m_modified[slot]));
 }
 
-size_t World::get_block_slot(size_t blk_x, size_t blk_y) const {
-    assert(contains_block(blk_x, blk_y));
-    return m_slotmap[blk_y - m_top][blk_x - m_left];
+//----------------------Snapshots----------------------
+//the header takes the first page, then every slot gets a page-aligned record
+//(left out for the empty slots), so the blocks can be used right from the mapping
+
+static const char SNAPSHOT_MAGIC[4] = { 'F', 'S', 'S', 'N' };
+static const uint32_t SNAPSHOT_VERSION = 2;
+static const uint64_t EMPTY_SLOT = UINT64_MAX;
+static const size_t SNAPSHOT_PAGE = 4096;
+static const size_t SNAPSHOT_STRIDE = (sizeof(Block) + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE * SNAPSHOT_PAGE;
+
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t num_blocks;
+    //block coordinates in every slot, EMPTY_SLOT for the empty ones
+    uint64_t coords[World::NUM_BLOCKS][2];
+};
+
+static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_PAGE, "snapshot header must fit into a page");
+static_assert(std::is_trivially_copyable<Block>::value, "blocks are written raw");
+
+static uint64_t record_offset(size_t slot) {
+    return SNAPSHOT_PAGE + slot * uint64_t(SNAPSHOT_STRIDE);
 }
 
-size_t World::find_unoccupied() const {
-    bool b[NUM_BLOCKS + 1]{};
-    for (size_t j = 0; j < NUM_BLOCKS; ++j)
-        for (size_t i = 0; i < NUM_BLOCKS; ++i)
-            b[m_slotmap[j][i]] = true;
-    return std::find(std::begin(b), std::end(b) - 1, false) - std::begin(b);
+static bool is_valid_header(const SnapshotHeader &h) {
+    return !memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) && h.version == SNAPSHOT_VERSION 
+        && h.record_size == sizeof(Block) && h.num_blocks == World::NUM_BLOCKS;
 }
 
-size_t World::recalc_slotmap(size_t new_left, size_t new_top) {
-    size_t unoccupied = NUM_BLOCKS;
-    Rect<size_t> new_bounds = mksl_bounds(new_left, new_top);
-    uint8_t new_slotmap[NUM_BLOCKS][NUM_BLOCKS];
-    memset(new_slotmap, NUM_BLOCKS, sizeof(new_slotmap));
-
-    for (size_t j = 0; j < NUM_BLOCKS; ++j) {
-        for (size_t i = 0; i < NUM_BLOCKS; ++i) {
-            size_t blk_x = m_left + i, blk_y = m_top + j;
-            if (new_bounds.contains(blk_x, blk_y)) {
-                //keep and remap the block
-                new_slotmap[blk_y - new_top][blk_x - new_left] = m_slotmap[j][i];
-            } else if (m_slotmap[j][i] != NUM_BLOCKS) {
-                unoccupied = m_slotmap[j][i];
-                unload_block(blk_x, blk_y);
+bool World::save_snapshot(const std::string &path) {
+    m_snapshot_chunks = 0;
+    //the evicted blocks go to the region files, so these stay consistent with the snapshot
+    if (m_io)
+        m_io->flush();
+
+    //the pending edits and the moves into the neighbours haven't reached the cur rects yet;
+    //needs_redrawing isn't tracked, it's render state and gets rebuilt after loading
+    for (auto &r: m_resident) {
+        for (size_t j = 0; j < Block::N; ++j) {
+            for (size_t i = 0; i < Block::N; ++i) {
+                if (!m_blocks[r.slot]->chunks[j][i].next_dirty_rect.is_empty())
+                    m_modified[r.slot][j][i] = true;
             }
         }
     }
 
-    m_left = new_left;
-    m_top = new_top;
-    memcpy(m_slotmap, new_slotmap, sizeof(new_slotmap));
-
-    return unoccupied;
-}
+    SnapshotHeader h{};
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.record_size = sizeof(Block);
+    h.num_blocks = NUM_BLOCKS;
+    for (auto &i: h.coords)
+        i[0] = i[1] = EMPTY_SLOT;
+    for (auto &r: m_resident) {
+        h.coords[r.slot][0] = r.blk_x;
+        h.coords[r.slot][1] = r.blk_y;
+    }
 
+    FILE *file = nullptr;
+    bool incremental = false;
+    if (path == m_snapshot_path) {
+        file = fopen(path.c_str(), "r+b");
+        SnapshotHeader old;
+        incremental = file && fread(&old, sizeof(old), 1, file) == 1 && is_valid_header(old);
+        if (file && !incremental) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+    if (!file) {
+        //a file that's mapped must not be truncated; writing into it in place is fine,
+        //the mapping is private and the written chunks are what's in memory anyway
+        if (path == m_mapped_path)
+            detach_snapshot();
+        file = fopen(path.c_str(), "wb");
+    }
+    if (!file) {
+        printf("FAILED TO OPEN SNAPSHOT %s\n", path.c_str());
+        return false;
+    }
 
-size_t World::furthest_occupied(size_t blk_x, size_t blk_y,
-            size_t &furthest_x, size_t &furthest_y) const 
-{
-    assert(contains_block(blk_x, blk_y));
-    int x = static_cast<int>(blk_x - m_left), y = static_cast<int>(blk_y - m_top),
-        max_d = 0;
-    size_t slot = NUM_BLOCKS;
-    for (int j = 0; j < NUM_BLOCKS; ++j) {
-        for (int i = 0; i < NUM_BLOCKS; ++i) {
-            int d = abs(x - i) + abs(y - j);
-            if (m_slotmap[j][i] != NUM_BLOCKS && d > max_d) {
-                max_d = d;
-                furthest_x = m_left + static_cast<size_t>(i);
-                furthest_y = m_top + static_cast<size_t>(j);
-                slot = m_slotmap[j][i];
+    bool ok = seek_file(file, 0) && fwrite(&h, sizeof(h), 1, file) == 1;
+    size_t written = 0;
+    for (size_t k = 0; ok && k < m_resident.size(); ++k) {
+        size_t slot = m_resident[k].slot;
+        const Block &blk = *m_blocks[slot];
+        uint64_t offset = record_offset(slot);
+        if (!incremental) {
+            ok = seek_file(file, offset) && fwrite(&blk, sizeof(blk), 1, file) == 1;
+            written += Block::N * Block::N;
+            continue;
+        }
+        for (size_t j = 0; ok && j < Block::N; ++j) {
+            for (size_t i = 0; ok && i < Block::N; ++i) {
+                if (!m_modified[slot][j][i])
+                    continue;
+                const Chunk &ch = blk.chunks[j][i];
+                uint64_t ch_offset = offset + static_cast<uint64_t>(
+                        reinterpret_cast<const char*>(&ch) - reinterpret_cast<const char*>(&blk));
+                ok = seek_file(file, ch_offset) && fwrite(&ch, sizeof(ch), 1, file) == 1;
+                ++written;
             }
         }
     }
+    ok = fclose(file) == 0 && ok;
 
-    return slot;
+    if (!ok) {
+        printf("FAILED TO WRITE SNAPSHOT %s\n", path.c_str());
+        m_snapshot_path.clear();
+        return false;
+    }
+    m_snapshot_path = path;
+    m_snapshot_chunks = written;
+    memset(m_modified, 0, sizeof(m_modified));
+    return true;
 }
 
+bool World::load_snapshot(const std::string &path) {
+    MappedFile mapped;
+    if (!mapped.open(path) || mapped.size() < sizeof(SnapshotHeader)) {
+        printf("FAILED TO MAP SNAPSHOT %s\n", path.c_str());
+        return false;
+    }
+    SnapshotHeader h;
+    memcpy(&h, mapped.data(), sizeof(h));
+    bool valid = is_valid_header(h);
+    for (size_t slot = 0; valid && slot < NUM_BLOCKS; ++slot)
+        valid = h.coords[slot][0] == EMPTY_SLOT || record_offset(slot) + sizeof(Block) <= mapped.size();
+    if (!valid) {
+        printf("INVALID SNAPSHOT %s\n", path.c_str());
+        return false;
+    }
 
-size_t World::include_block(size_t blk_x, size_t blk_y) {
-    if (contains_block(blk_x, blk_y)) {
-        size_t available = find_unoccupied();
-        if (available != NUM_BLOCKS) {
-            m_slotmap[blk_y - m_top][blk_x - m_left] = static_cast<uint8_t>(available);
-            return available;
+    //the loads in flight belong to the old world
+    if (m_io) {
+        m_io->flush();
+        m_loaded.clear();
+        m_io->poll(m_loaded);
+        for (auto &i: m_loaded)
+            m_io->discard(i);
+        m_loaded.clear();
+    }
+    m_wanted.clear();
+
+    for (auto &row: m_ring)
+        for (auto &cell: row)
+            cell.slot = NUM_BLOCKS;
+    m_resident.clear();
+    m_free_slots.clear();
+    for (size_t k = 0; k < NUM_BLOCKS; ++k) {
+        size_t slot = NUM_BLOCKS - 1 - k;
+        m_storage[slot].reset();
+        m_blocks[slot] = nullptr;
+        if (h.coords[slot][0] == EMPTY_SLOT) {
+            m_free_slots.push_back(slot);
+            continue;
         }
-
-        size_t furthest_x = 0, furthest_y = 0;
-        assert(furthest_occupied(blk_x, blk_y, furthest_x, furthest_y) != NUM_BLOCKS);
-
-        uint8_t furthest = m_slotmap[furthest_y - m_top][furthest_x - m_left];
-        m_slotmap[blk_y - m_top][blk_x - m_left] = furthest;
-        m_slotmap[furthest_y - m_top][furthest_x - m_left] = NUM_BLOCKS;
-        return furthest;
+        m_blocks[slot] = reinterpret_cast<Block*>(mapped.data() + record_offset(slot));
+        m_active[slot] = true;
+        m_hash_stale[slot] = true;
+        Resident r = { static_cast<size_t>(h.coords[slot][0]), static_cast<size_t>(h.coords[slot][1]), slot };
+        ring_cell(r.blk_x, r.blk_y) = r;
+        m_resident.push_back(r);
     }
+    std::sort(m_resident.begin(), m_resident.end(), resident_order);
+    m_mapped.swap(mapped);
+    m_mapped_path = path;
+    m_snapshot_path = path;
+    memset(m_modified, 0, sizeof(m_modified));
+    //no restore_block() here, it would fault in every chunk;
+    //the caller redraws whatever is on screen
+    return true;
+}
 
-    Rect<size_t> new_bounds[4] = {
-        //top left
-        mksl_bounds(sat_sub(blk_x, NUM_BLOCKS - 1), sat_sub(blk_y, NUM_BLOCKS - 1)),
-        //top right
-        mksl_bounds(blk_x, sat_sub(blk_y, NUM_BLOCKS - 1)),
-        //bottom left
-        mksl_bounds(sat_sub(blk_x, NUM_BLOCKS - 1), blk_y),
-        //bottom right
-        mksl_bounds(blk_x, blk_y)
-    };
-    Rect<size_t> old_bounds = mksl_bounds(m_left, m_top),
-        new_combined(new_bounds[0].left, new_bounds[0].top,
-                new_bounds[3].right, new_bounds[3].bottom);
-    auto pred = [&old_bounds](auto &lhs, auto &rhs) { 
-        return old_bounds.shared_area(lhs) < old_bounds.shared_area(rhs);
-    };
-
-    Rect<size_t> &best = *std::max_element(
-            std::begin(new_bounds), std::end(new_bounds), pred);
-
-    size_t unoccupied = recalc_slotmap(best.left, best.top);
-    if (unoccupied != NUM_BLOCKS) {
-        //at least one block got removed lmao get hecking recked
-        m_slotmap[blk_y - m_top][blk_x - m_left] = static_cast<uint8_t>(unoccupied);
-        return unoccupied;
-    } 
-
-    unoccupied = find_unoccupied();
-    if (unoccupied != NUM_BLOCKS) {
-        m_slotmap[blk_y - m_top][blk_x - m_left] = unoccupied;
-        return unoccupied;
+void World::detach_snapshot() {
+    if (!m_mapped.is_open())
+        return;
+    for (size_t slot = 0; slot < NUM_BLOCKS; ++slot) {
+        if (!m_blocks[slot] || m_storage[slot])
+            continue;
+        m_storage[slot].reset(new Block);
+        memcpy(static_cast<void*>(m_storage[slot].get()), m_blocks[slot], sizeof(Block));
+        m_blocks[slot] = m_storage[slot].get();
     }
+    m_mapped.close();
+    m_mapped_path.clear();
+}
 
-    size_t freed_x, freed_y;
-    unoccupied = furthest_occupied(blk_x, blk_y, freed_x, freed_y);
-    assert(unoccupied != NUM_BLOCKS);
-    unload_block(freed_x, freed_y);
-    m_slotmap[freed_y - m_top][freed_x - m_left] = NUM_BLOCKS;
-    m_slotmap[blk_y - m_top][blk_x - m_left] = unoccupied;
-    return unoccupied;
+
+void World::unload_block(size_t blk_x, size_t blk_y, size_t slot) {
+    if (m_io)
+        m_io->store(blk_x, blk_y, *m_blocks[slot]);
 }
 
-void World::fit_block(size_t blk_x, size_t blk_y, Block &blk, bool keep_old) {
-    Rect<int> r;
+void World::restore_block(size_t blk_x, size_t blk_y, Block &blk) {
+    //whatever was on screen at that place belonged to some other block
     size_t off_chx = blk_x * Block::N, off_chy = blk_y * Block::N;
     for (size_t j = 0; j < Block::N; ++j) {
         for (size_t i = 0; i < Block::N; ++i) {
-            size_t ch_x = off_chx + i, ch_y = off_chy + j;
-            auto &ch = blk.chunks[j][i];
-            if (ch.next_dirty_rect.is_empty())
-                continue;
-
-            auto &bounds = ch.next_dirty_rect;
-            if (ch_x) {
-                //Left
-                r = chunk_bounds(ch_x - 1, ch_y);
-                if (bounds.intersects(r))
-                    get_chunk(ch_x - 1, ch_y).next_dirty_rect.include(bounds.intersection(r));
-
-                //Top left
-                if (ch_y) {
-                    r = chunk_bounds(ch_x - 1, ch_y - 1);
-                    if (bounds.intersects(r))
-                        get_chunk(ch_x - 1, ch_y - 1).next_dirty_rect.include(bounds.intersection(r));
-                }
-
-                //Bottom left
-                if (is_chunk_loaded(ch_x - 1, ch_y + 1)) {
-                    r = chunk_bounds(ch_x - 1, ch_y + 1);
-                    if (bounds.intersects(r))
-                        get_chunk(ch_x - 1, ch_y + 1).next_dirty_rect.include(bounds.intersection(r));
-                }
-            }
+            for (auto &r: blk.chunks[j][i].needs_redrawing)
+                r = chunk_bounds(off_chx + i, off_chy + j);
+        }
+    }
+}
 
-            if (is_chunk_loaded(ch_x + 1, ch_y)) {
-                //Right
-                r = chunk_bounds(ch_x + 1, ch_y);
-                if (bounds.intersects(r))
-                    get_chunk(ch_x + 1, ch_y).next_dirty_rect.include(bounds.intersection(r));
-
-                //Top right
-                if (ch_y) {
-                    r = chunk_bounds(ch_x + 1, ch_y - 1);
-                    if (bounds.intersects(r))
-                        get_chunk(ch_x + 1, ch_y - 1).next_dirty_rect.include(bounds.intersection(r));
-                }
+bool World::resident_order(const Resident &lhs, const Resident &rhs) {
+    return std::make_pair(lhs.blk_y, lhs.blk_x) < std::make_pair(rhs.blk_y, rhs.blk_x);
+}
 
-                //Bottom right
-                if (is_chunk_loaded(ch_x + 1, ch_y + 1)) {
-                    r = chunk_bounds(ch_x + 1, ch_y + 1);
-                    if (bounds.intersects(r))
-                        get_chunk(ch_x + 1, ch_y + 1).next_dirty_rect.include(bounds.intersection(r));
-                }
-            }
+World::Resident& World::ring_cell(size_t blk_x, size_t blk_y) {
+    return m_ring[blk_y & (RING_SIZE - 1)][blk_x & (RING_SIZE - 1)];
+}
 
-            //Top
-            if (ch_y) {
-                r = chunk_bounds(ch_x, ch_y - 1);
-                if (bounds.intersects(r))
-                    get_chunk(ch_x, ch_y - 1).next_dirty_rect.include(bounds.intersection(r));
-            }
+const World::Resident& World::ring_cell(size_t blk_x, size_t blk_y) const {
+    return m_ring[blk_y & (RING_SIZE - 1)][blk_x & (RING_SIZE - 1)];
+}
 
-            //Bottom
-            if (is_chunk_loaded(ch_x, ch_y + 1)) {
-                r = chunk_bounds(ch_x, ch_y + 1);
-                if (bounds.intersects(r))
-                    get_chunk(ch_x, ch_y + 1).next_dirty_rect.include(bounds.intersection(r));
-            }
+void World::evict(size_t blk_x, size_t blk_y) {
+    Resident &cell = ring_cell(blk_x, blk_y);
+    assert(cell.slot != NUM_BLOCKS && cell.blk_x == blk_x && cell.blk_y == blk_y);
+    unload_block(blk_x, blk_y, cell.slot);
+    auto it = std::lower_bound(m_resident.begin(), m_resident.end(), cell, resident_order);
+    assert(it != m_resident.end() && it->slot == cell.slot);
+    m_resident.erase(it);
+    m_free_slots.push_back(cell.slot);
+    cell.slot = NUM_BLOCKS;
+}
 
-            ch.next_dirty_rect = ch.next_dirty_rect.intersection(chunk_bounds(ch_x, ch_y));
-            //this can possibly fix the issue with chunk borders;
-            //BUT: the overlap must be carefully controlled to avoid data races!!!
-            //(not WORLD_BOUNDS, but rather LOADED_BOUNDS, which isn't necceserily a rectangle...)
-            /* ch.next_dirty_rect = ch.next_dirty_rect.intersection(WORLD_BOUNDS); */
-        }
+size_t World::include_block(size_t blk_x, size_t blk_y) {
+    assert(!is_block_loaded(blk_x, blk_y));
+    //a block RING_SIZE away takes the same cell
+    Resident &cell = ring_cell(blk_x, blk_y);
+    if (cell.slot != NUM_BLOCKS)
+        evict(cell.blk_x, cell.blk_y);
+
+    if (m_free_slots.empty()) {
+        //out of slots: the furthest block, preferably one that isn't wanted
+        auto score = [&](const Resident &r) {
+            bool wanted = std::find(m_wanted.begin(), m_wanted.end(), 
+                    std::make_pair(r.blk_x, r.blk_y)) != m_wanted.end();
+            size_t d = (r.blk_x > blk_x ? r.blk_x - blk_x : blk_x - r.blk_x)
+                + (r.blk_y > blk_y ? r.blk_y - blk_y : blk_y - r.blk_y);
+            return std::make_pair(!wanted, d);
+        };
+        auto furthest = std::max_element(m_resident.begin(), m_resident.end(), 
+                [&](const Resident &lhs, const Resident &rhs) { return score(lhs) < score(rhs); });
+        assert(furthest != m_resident.end());
+        evict(furthest->blk_x, furthest->blk_y);
     }
 
-    for (size_t j = 0; j < Block::N; ++j) {
-        for (size_t i = 0; i < Block::N; ++i) {
-            auto &ch = blk.chunks[j][i];
-            ch.cur_dirty_rect = ch.next_dirty_rect;
-            ch.next_dirty_rect.reset();
-
-            if (!ch.cur_dirty_rect.is_empty()) {
-                ch.needs_redrawing.include(chunk_bounds(off_chx + i, off_chy + j).intersection(ch.cur_dirty_rect));
-            }
-        }
+    size_t slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    //whatever gets put into the slot has to be fitted at least once
+    m_active[slot] = true;
+    m_hash_stale[slot] = true;
+    if (!m_blocks[slot]) {
+        m_storage[slot].reset(new Block);
+        m_blocks[slot] = m_storage[slot].get();
     }
+    cell = { blk_x, blk_y, slot };
+    m_resident.insert(std::upper_bound(m_resident.begin(), m_resident.end(), cell, resident_order), cell);
+    return slot;
 }
-
@@ -4,14 +4,28 @@
 #include "particle.hpp"
 #include "rect.hpp"
 #include <cassert>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <string>
+#include "block_io.hpp"
+#include "mapped_file.hpp"
+#include "terrain.hpp"
+
+class RegionStore;
 
 struct Chunk {
     static const size_t SIZE = 64;
+    //levels of detail: 1:1, 2x, 4x and 8x downsampled
+    static const size_t NUM_LODS = 4;
 
     Particle& get(size_t x, size_t y);
     const Particle& get(size_t x, size_t y) const;
 
     bool is_dirty() const { return !cur_dirty_rect.is_empty(); }
+    //checks whether all the cells are of the same type, for a chunk that has just settled
+    void detect_uniform();
 
     Particle data[SIZE][SIZE];
 
@@ -19,7 +33,14 @@ struct Chunk {
     //and might be larger than the size of chunk;
     //these are absolute coordinates
     Rect<int> cur_dirty_rect, next_dirty_rect;
-    Rect<int> needs_redrawing;
+    //one for each level of detail, so the levels that aren't on screen
+    //can catch up later instead of being redrawn from scratch
+    Rect<int> needs_redrawing[NUM_LODS];
+
+    //a settled chunk made of a single (non-burning) type: it gets drawn as a flat fill
+    //without looking at the cells; cleared as soon as the chunk becomes dirty again
+    bool is_uniform;
+    Particle uniform;
 };
 
 struct Block {
@@ -41,13 +62,28 @@ inline Rect<int> chunk_bounds(int ch_x, int ch_y) {
     );
 }
 
-//a wrapper around array of blocks, 
-//which will be generated or loaded / unloaded dynamically
+//a wrapper around the resident blocks, 
+//which get generated or loaded / unloaded dynamically
 class World {
 public:
-    static const size_t NUM_BLOCKS = 2;
-
-    World();
+    //resident blocks at most, their storage is allocated on first use
+    static const size_t NUM_BLOCKS = 64;
+    //the resident blocks are addressed by their coordinates modulo RING_SIZE,
+    //so two blocks RING_SIZE apart can't be resident at the same time
+    static const size_t RING_SIZE = 16;
+    //how far ahead the camera movement gets extrapolated
+    static const int PREFETCH_TICKS = 30;
+
+    //recently evicted blocks are kept compressed in memory, up to this many bytes
+    static const size_t DEFAULT_CACHE_BUDGET = 64 << 20;
+
+    //without a store, the blocks that leave the resident window are lost;
+    //without a generator, the blocks that have never been stored start out empty
+    explicit World(std::unique_ptr<RegionStore> store = nullptr,
+            size_t cache_budget = DEFAULT_CACHE_BUDGET,
+            std::unique_ptr<TerrainGenerator> generator = nullptr);
+    //writes the resident blocks to the store
+    ~World();
 
     bool is_particle_loaded(size_t x, size_t y) const;
     bool is_chunk_loaded(size_t ch_x, size_t ch_y) const;
@@ -59,8 +95,11 @@ public:
     Particle& get(size_t x, size_t y);
     const Particle& get(size_t x, size_t y) const;
 
-    void fit_dirty_rects(bool keep_old);
-
+    //turns the next rects that overlap the block's chunks (their own and the neighbours' ones)
+    //into their cur rects; only the block gets written, so the blocks can be fitted in parallel.
+    //The next rects are left alone, the neighbours read them as well:
+    //they have to be reset once all the blocks are done (see Simulation::prepare_chunk())
+    void fit_block(size_t blk_x, size_t blk_y);
 
     Block& get_block(size_t blk_x, size_t blk_y);
     const Block& get_block(size_t blk_x, size_t blk_y) const;
@@ -68,47 +107,119 @@ public:
     //enumerates all loaded blocks row by row, each from left to right
     template<typename F>
     void enumerate_blocks(F &f) {
-        for (size_t j = 0; j < NUM_BLOCKS; ++j) {
-            for (size_t i = 0; i < NUM_BLOCKS; ++i) {
-                size_t slot = m_slotmap[j][i];
-                if (slot == NUM_BLOCKS)
-                    continue;
-                size_t blk_x = m_left + i, blk_y = m_top + j;
-                f(blk_x, blk_y, m_blocks[slot]);
-            }
-        }
+        for (auto &i: m_resident)
+            f(i.blk_x, i.blk_y, *m_blocks[i.slot]);
     }
 
-    void load_block(size_t blk_x, size_t blk_y);
+    //only the blocks with dirty chunks, the rest of the resident ones are left alone
+    template<typename F>
+    void enumerate_active_blocks(F &f) {
+        for (auto &i: m_resident)
+            if (m_active[i.slot].load(std::memory_order_relaxed))
+                f(i.blk_x, i.blk_y, *m_blocks[i.slot]);
+    }
 
-private:
-    size_t m_left, m_top;
-    uint8_t m_slotmap[NUM_BLOCKS][NUM_BLOCKS];
-    //slots for storing blocks
-    //these are supposed to be lying contiguosly in the world
-    //(in the worst case - in a straight line with lenghth of NUM_BLOCKS blocks)
-    Block m_blocks[NUM_BLOCKS];
+    size_t num_resident() const { return m_resident.size(); }
 
-    //This method gets called during the update of the slotmap
-    //so it'd better not touch anything!
-    void unload_block(size_t blk_x, size_t blk_y);
+    //in bytes: the allocated block slots along with the world's own tables,
+    //the mapped snapshot, and what the I/O thread holds (0 without a store)
+    size_t resident_bytes() const;
+    size_t snapshot_bytes() const { return m_mapped.size(); }
+    size_t cache_bytes() const;
+    size_t staging_bytes() const;
 
-    //--------------Helpers--------------
+    //must be called whenever a next_dirty_rect in the block gets extended,
+    //idle blocks don't get fitted; safe to call from the workers
+    void mark_active(size_t blk_x, size_t blk_y);
+    //for the next rects poking out of the block, the loaded neighbours have to gather them
+    void mark_active_around(size_t blk_x, size_t blk_y);
 
-    bool contains_block(size_t blk_x, size_t blk_y) const;
-    size_t get_block_slot(size_t blk_x, size_t blk_y) const;
+    //synchronous, waits for the storage
+    void load_block(size_t blk_x, size_t blk_y);
 
-    size_t find_unoccupied() const;
-    size_t furthest_occupied(size_t blk_x, size_t blk_y,
-            size_t &furthest_x, size_t &furthest_y) const;
+    //picks the blocks to be resident from the view, its velocity (in pixels per tick)
+    //and the activity near block borders, and requests the missing ones in the background
+    void prefetch(const Rect<int> &view, float vx, float vy);
+    //swaps in the blocks that have been read in the meantime, never waits for the storage
+    void poll_io();
+
+    //content hashes, for checking that two runs of the same scenario stay in step;
+    //the been-updated flags don't count. They're kept per chunk and only refreshed by rehash_chunk()
+    //(for the chunks that might have changed), the blocks loaded since get hashed from scratch when asked for
+    static uint64_t hash_chunk(const Chunk &ch);
+    //safe to call from the workers, each for a different chunk
+    void rehash_chunk(size_t ch_x, size_t ch_y);
+    uint64_t chunk_hash(size_t ch_x, size_t ch_y);
+    uint64_t block_hash(size_t blk_x, size_t blk_y);
+    //the resident blocks with their coordinates
+    uint64_t world_hash();
+    //everything from scratch, the kept hashes are left alone; to check them
+    uint64_t compute_world_hash() const;
+    //for when the chunks got written to without rehash_chunk() following
+    void invalidate_hashes();
+
+    //writes the resident blocks into a single file;
+    //saving again into the last saved (or loaded) snapshot only rewrites the modified chunks
+    bool save_snapshot(const std::string &path);
+    //by the last save_snapshot(), every resident one for a full save
+    size_t snapshot_chunks_written() const { return m_snapshot_chunks; }
+    //maps the snapshot copy-on-write, so the blocks get paged in lazily as they're touched.
+    //The resident blocks get replaced without being stored, but the region files aren't rolled back:
+    //the blocks evicted since the snapshot was saved come back in their newer state,
+    //so it's a consistent checkpoint only for the blocks it contains
+    bool load_snapshot(const std::string &path);
 
-    //returns a slot that got freed after applying new bounds (or NUM_BLOCKS if none was freed)
-    size_t recalc_slotmap(size_t new_left, size_t new_top);
+private:
+    struct Resident {
+        size_t blk_x, blk_y, slot;
+    };
+
+    //indexed by the block coordinates modulo RING_SIZE; slot is NUM_BLOCKS if the cell is empty
+    Resident m_ring[RING_SIZE][RING_SIZE];
+    //sorted by rows, then columns
+    std::vector<Resident> m_resident;
+    std::vector<size_t> m_free_slots;
+    //they point either into m_storage or into the mapped snapshot (nullptr until first used)
+    Block *m_blocks[NUM_BLOCKS];
+    std::unique_ptr<Block> m_storage[NUM_BLOCKS];
+    MappedFile m_mapped;
+    std::string m_mapped_path, m_snapshot_path;
+    size_t m_snapshot_chunks;
+    //blocks that have (or are about to have) dirty chunks
+    std::atomic<bool> m_active[NUM_BLOCKS];
+    //per chunk, see hash_chunk(); the whole block is stale once something new gets put into the slot
+    uint64_t m_chunk_hashes[NUM_BLOCKS][Block::N][Block::N];
+    bool m_hash_stale[NUM_BLOCKS];
+    //chunks that might differ from m_snapshot_path
+    bool m_modified[NUM_BLOCKS][Block::N][Block::N];
+    //shared with the I/O thread, so it goes before m_io
+    std::unique_ptr<TerrainGenerator> m_generator;
+    std::unique_ptr<BlockIO> m_io;
+    std::vector<std::pair<size_t, size_t>> m_wanted;
+    std::vector<BlockIO::Loaded> m_loaded;
+
+    void unload_block(size_t blk_x, size_t blk_y, size_t slot);
+    //called after a block has been read back from the store
+    void restore_block(size_t blk_x, size_t blk_y, Block &blk);
+    static void reset_block(Block &blk);
+    //for the blocks that have never been stored
+    void create_block(size_t blk_x, size_t blk_y, Block &blk);
+    void mark_modified(size_t slot);
+    //moves the blocks out of the mapping into m_storage
+    void detach_snapshot();
+    //the dirty area near the block border grown by a chunk, empty if it doesn't cross the border
+    Rect<int> active_neighbourhood(size_t blk_x, size_t blk_y, const Block &blk) const;
 
-    //reserves a place for the block and removes the furthest block(s) if needed
-    size_t include_block(size_t blk_x, size_t blk_y);
+    //--------------Helpers--------------
+
+    static bool resident_order(const Resident &lhs, const Resident &rhs);
+    Resident& ring_cell(size_t blk_x, size_t blk_y);
+    const Resident& ring_cell(size_t blk_x, size_t blk_y) const;
 
-    void fit_block(size_t blk_x, size_t blk_y, Block &blk, bool keep_old);
+    //evicts whatever sits in the same ring cell, or the block furthest away
+    //that isn't wanted when out of slots; returns the slot reserved for the block
+    size_t include_block(size_t blk_x, size_t blk_y);
+    void evict(size_t blk_x, size_t blk_y);
 };
 
 #endif